@@ -0,0 +1,337 @@
+#include "utils.h"
+
+/* Files written and read by the benchmark (see --results, --baseline) */
+#define BENCH_RESULTS "bench_results.jsonl"
+#define BENCH_BASELINE "bench_baseline.jsonl"
+#define BENCH_EXPORT "bench_export.csv"
+
+/*
+ * Relative increase (over the baseline) of the CPU time or of the IPC calls per delivered ton
+ * reported as a regression: the wall time is not compared, it's bound to the days
+ */
+#define BENCH_TOLERANCE 0.20
+
+#define BENCH_CONFIGS 10
+
+/*
+ *
+ * This struct contains the result of the run of a configuration:
+ *    - the configuration (1-10) and the seed
+ *    - the days simulated, the wall time (in seconds) and the days simulated each second
+ *    - the tons delivered and the IPC calls of every process for each of them
+ *    - the CPU time (user and system, in seconds) of the master and of every port and ship,
+ *      and the largest resident set size of them (in kilobytes)
+ *
+ */
+struct bench_result {
+   int config;
+   unsigned int seed;
+   int days;
+   double wall;
+   double days_per_second;
+   long delivered;
+   double ipc_per_ton;
+   double cpu;
+   long max_rss;
+};
+
+int run_config(int, unsigned int, struct bench_result *);
+int read_export(struct bench_result *);
+int field_index(char *, char *);
+void write_result(FILE *, struct bench_result *);
+int read_baseline(char *, struct bench_result *);
+int compare_result(struct bench_result *, struct bench_result *);
+
+int main(int argc, char *argv[]) {
+   struct bench_result results[BENCH_CONFIGS], baseline[BENCH_CONFIGS];
+   char *results_path = BENCH_RESULTS, *baseline_path = BENCH_BASELINE;
+   int i, option, first = 1, last = BENCH_CONFIGS, save = 0, regressions = 0;
+   unsigned int seed = 1;
+   FILE *file;
+   static struct option options[] = {
+      {"configs", required_argument, NULL, 'c'},
+      {"seed", required_argument, NULL, 's'},
+      {"results", required_argument, NULL, 'r'},
+      {"baseline", required_argument, NULL, 'b'},
+      {"save-baseline", no_argument, NULL, 'S'},
+      {NULL, 0, NULL, 0}
+   };
+
+   /*
+    * --configs runs only the configurations FIRST-LAST (1-5 are the base ones, 6-10 the same
+    * scaled up), --seed is passed to the master, --results and --baseline change the files,
+    * --save-baseline replaces the baseline with the results of this run
+    */
+   while((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+      switch(option) {
+         case 'c':
+            if(sscanf(optarg, "%d-%d", &first, &last) == 1) {
+               last = first;
+            }
+            if(first < 1 || last > BENCH_CONFIGS || first > last) {
+               fprintf(stderr, "Unknown configs %s (FIRST-LAST, 1-%d)\n", optarg, BENCH_CONFIGS);
+               return EXIT_FAILURE;
+            }
+            break;
+         case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+         case 'r':
+            results_path = optarg;
+            break;
+         case 'b':
+            baseline_path = optarg;
+            break;
+         case 'S':
+            save = 1;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [--configs FIRST-LAST] [--seed SEED] [--results FILE] "
+               "[--baseline FILE] [--save-baseline]\n", argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+
+   if((file = fopen(results_path, "w")) == NULL) {
+      perror("results file open failed!");
+      return EXIT_FAILURE;
+   }
+   for(i=first; i<=last; i++) {
+      printf("Config %d: ", i);
+      fflush(stdout);
+      if(run_config(i, seed, &results[i-1]) == -1) {
+         fclose(file);
+         return EXIT_FAILURE;
+      }
+      printf("%.3f s, %ld tons delivered, %.3f IPC calls/ton, CPU: %.3f s, max RSS: %ld KB\n",
+         results[i-1].wall, results[i-1].delivered, results[i-1].ipc_per_ton, results[i-1].cpu, results[i-1].max_rss);
+      write_result(file, &results[i-1]);
+   }
+   fclose(file);
+
+   if(save) {
+      if((file = fopen(baseline_path, "w")) == NULL) {
+         perror("baseline file open failed!");
+         return EXIT_FAILURE;
+      }
+      for(i=first; i<=last; i++) {
+         write_result(file, &results[i-1]);
+      }
+      fclose(file);
+      printf("\nBaseline saved to %s\n", baseline_path);
+      return EXIT_SUCCESS;
+   }
+
+   if(read_baseline(baseline_path, baseline) == -1) {
+      printf("\nNo baseline in %s (see --save-baseline)\n", baseline_path);
+      return EXIT_SUCCESS;
+   }
+   printf("\nCompared with %s (regressions over %.0f%%):\n", baseline_path, BENCH_TOLERANCE * 100);
+   for(i=first; i<=last; i++) {
+      regressions += compare_result(&results[i-1], &baseline[i-1]);
+   }
+
+   return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * This method runs the master with the given configuration and seed, without the report and
+ * exporting to BENCH_EXPORT, and fills the given result: returns -1 if the run failed
+ */
+int run_config(int config, unsigned int seed, struct bench_result *result) {
+   char config_arg[16], seed_arg[16];
+   char *args[] = {"./master", "--config", NULL, "--seed", NULL, "--report", "none", "--export", BENCH_EXPORT, NULL};
+   struct timespec start, end;
+   struct rusage usage;
+   int status, null_fd;
+   pid_t pid;
+
+   sprintf(config_arg, "%d", config);
+   sprintf(seed_arg, "%u", seed);
+   args[2] = config_arg;
+   args[4] = seed_arg;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   pid = fork();
+   if(pid == -1) {
+      perror("fork failed!");
+      return -1;
+   } else if(pid == 0) {
+      null_fd = open("/dev/null", O_WRONLY);
+      dup2(null_fd, STDOUT_FILENO);
+      execv("./master", args);
+      perror("execv master error");
+      exit(EXIT_FAILURE);
+   }
+
+   /* The usage of the master includes the ports and the ships, that it reaped */
+   while(wait4(pid, &status, 0, &usage) == -1) {
+      if(errno != EINTR) {
+         perror("wait4 failed!");
+         return -1;
+      }
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      fprintf(stderr, "the master of config %d failed!\n", config);
+      return -1;
+   }
+
+   result->config = config;
+   result->seed = seed;
+   result->wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   result->cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+   result->max_rss = usage.ru_maxrss;
+   if(read_export(result) == -1) {
+      fprintf(stderr, "the export of config %d can't be read!\n", config);
+      return -1;
+   }
+   result->days_per_second = result->days / result->wall;
+
+   unlink(BENCH_EXPORT);
+   return 0;
+}
+
+/*
+ * This method reads the days, the tons delivered (the sum of the "product" records of the
+ * last day) and the IPC calls (the sum of the "ipc" records) from the export of the run.
+ * The fields are found by their names in the header lines of the CSV (see export.c)
+ */
+int read_export(struct bench_result *result) {
+   char line[1024], *field;
+   int i, delivered_index = -1, calls_index = -1, day, product_day = -1;
+   long value, ipc_calls = 0;
+   FILE *file;
+
+   if((file = fopen(BENCH_EXPORT, "r")) == NULL) {
+      return -1;
+   }
+   result->days = 0;
+   result->delivered = 0;
+   while(fgets(line, sizeof(line), file) != NULL) {
+      if(strncmp(line, "#product,", 9) == 0) {
+         delivered_index = field_index(line, "delivered");
+         continue;
+      } else if(strncmp(line, "#ipc,", 5) == 0) {
+         calls_index = field_index(line, "calls");
+         continue;
+      } else if(line[0] == '#') {
+         continue;
+      }
+
+      /* The kind, the schema and the day come first */
+      field = strtok(line, ",\n");
+      for(i=0; field != NULL && i<2; i++) {
+         field = strtok(NULL, ",\n");
+      }
+      if(field == NULL) {
+         continue;
+      }
+      day = atoi(field);
+      if(day > result->days) {
+         result->days = day;
+      }
+
+      if(strcmp(line, "product") == 0 && delivered_index != -1) {
+         for(i=2; field != NULL && i<delivered_index; i++) {
+            field = strtok(NULL, ",\n");
+         }
+         value = field != NULL ? atol(field) : 0;
+         if(day != product_day) {
+            product_day = day;
+            result->delivered = 0;
+         }
+         result->delivered += value;
+      } else if(strcmp(line, "ipc") == 0 && calls_index != -1) {
+         for(i=2; field != NULL && i<calls_index; i++) {
+            field = strtok(NULL, ",\n");
+         }
+         ipc_calls += field != NULL ? atol(field) : 0;
+      }
+   }
+   fclose(file);
+
+   if(delivered_index == -1 || calls_index == -1) {
+      return -1;
+   }
+   result->ipc_per_ton = result->delivered > 0 ? (double)ipc_calls / result->delivered : 0;
+   return 0;
+}
+
+/*
+ * This method returns the index of the field with the given name in the given header line
+ * of the CSV ("#kind,schema,day,..."), -1 if it's not there
+ */
+int field_index(char *line, char *name) {
+   char copy[1024], *field;
+   int i;
+
+   strncpy(copy, line, sizeof(copy) - 1);
+   copy[sizeof(copy) - 1] = '\0';
+   for(i=0, field = strtok(copy, ",\n"); field != NULL; i++, field = strtok(NULL, ",\n")) {
+      if(strcmp(field, name) == 0) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+/*
+ * This method writes the given result as a line of JSON
+ */
+void write_result(FILE *file, struct bench_result *result) {
+   fprintf(file, "{\"config\":%d,\"seed\":%u,\"days\":%d,\"wall_s\":%.3f,\"days_per_s\":%.3f,"
+      "\"delivered\":%ld,\"ipc_per_ton\":%.3f,\"cpu_s\":%.3f,\"max_rss_kb\":%ld}\n",
+      result->config, result->seed, result->days, result->wall, result->days_per_second,
+      result->delivered, result->ipc_per_ton, result->cpu, result->max_rss);
+}
+
+/*
+ * This method reads the results of the baseline, indexed by configuration (the ones
+ * missing have config 0): returns -1 if it can't be read
+ */
+int read_baseline(char *path, struct bench_result *baseline) {
+   struct bench_result result;
+   char line[1024];
+   FILE *file;
+
+   if((file = fopen(path, "r")) == NULL) {
+      return -1;
+   }
+   memset(baseline, 0, BENCH_CONFIGS * sizeof(struct bench_result));
+   while(fgets(line, sizeof(line), file) != NULL) {
+      if(sscanf(line, "{\"config\":%d,\"seed\":%u,\"days\":%d,\"wall_s\":%lf,\"days_per_s\":%lf,"
+            "\"delivered\":%ld,\"ipc_per_ton\":%lf,\"cpu_s\":%lf,\"max_rss_kb\":%ld}",
+            &result.config, &result.seed, &result.days, &result.wall, &result.days_per_second,
+            &result.delivered, &result.ipc_per_ton, &result.cpu, &result.max_rss) == 9
+            && result.config >= 1 && result.config <= BENCH_CONFIGS) {
+         baseline[result.config - 1] = result;
+      }
+   }
+   fclose(file);
+   return 0;
+}
+
+/*
+ * This method prints the given result compared with its baseline: returns 1 if the CPU time
+ * or the IPC calls per ton grew more than BENCH_TOLERANCE, 0 otherwise
+ */
+int compare_result(struct bench_result *result, struct bench_result *baseline) {
+   double cpu_change, ipc_change;
+   int regression;
+
+   if(baseline->config == 0) {
+      printf("\tConfig %d: not in the baseline\n", result->config);
+      return 0;
+   }
+   cpu_change = baseline->cpu > 0 ? result->cpu / baseline->cpu - 1 : 0;
+   ipc_change = baseline->ipc_per_ton > 0 ? result->ipc_per_ton / baseline->ipc_per_ton - 1 : 0;
+   regression = cpu_change > BENCH_TOLERANCE || ipc_change > BENCH_TOLERANCE;
+
+   printf("\tConfig %d: CPU %+.1f%%, IPC calls/ton %+.1f%%, tons delivered %+.1f%%, max RSS %+.1f%%%s%s\n",
+      result->config, cpu_change * 100, ipc_change * 100,
+      baseline->delivered > 0 ? ((double)result->delivered / baseline->delivered - 1) * 100 : 0,
+      baseline->max_rss > 0 ? ((double)result->max_rss / baseline->max_rss - 1) * 100 : 0,
+      regression ? "  REGRESSION" : "", result->seed != baseline->seed ? " (different seed)" : "");
+   return regression;
+}
@@ -0,0 +1,159 @@
+#include "utils.h"
+#include "executor.h"
+
+struct task *tasks;
+int tasks_count, current_task = -1;
+
+/* The min-heap of the suspended tasks, ordered by wake up time (see struct task) */
+int *timer_heap;
+int timer_heap_size = 0;
+
+/* The context of the executor, where the tasks return when they suspend themselves */
+ucontext_t executor_context;
+
+void (*task_entry)(void);
+void (*task_switch_in)(int);
+void (*task_switch_out)(int);
+void (*executor_between)(void);
+
+double monotonic_now();
+void timer_heap_push(int);
+int timer_heap_pop();
+void run_task();
+
+/*
+ * This method returns the current instant (CLOCK_MONOTONIC) in seconds
+ */
+double monotonic_now() {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * This method adds the given task to the timer heap
+ */
+void timer_heap_push(int task) {
+   int pos = timer_heap_size++, parent;
+
+   while(pos > 0 && tasks[timer_heap[parent = (pos - 1) / 2]].wake > tasks[task].wake) {
+      timer_heap[pos] = timer_heap[parent];
+      pos = parent;
+   }
+   timer_heap[pos] = task;
+}
+
+/*
+ * This method removes the task with the earliest wake up time from the timer heap and returns it
+ */
+int timer_heap_pop() {
+   int top = timer_heap[0], last = timer_heap[--timer_heap_size], pos = 0, child;
+
+   while((child = 2 * pos + 1) < timer_heap_size) {
+      if(child + 1 < timer_heap_size && tasks[timer_heap[child + 1]].wake < tasks[timer_heap[child]].wake) {
+         child++;
+      }
+      if(tasks[timer_heap[child]].wake >= tasks[last].wake) {
+         break;
+      }
+      timer_heap[pos] = timer_heap[child];
+      pos = child;
+   }
+   timer_heap[pos] = last;
+
+   return top;
+}
+
+/*
+ * This method is the starting point of every task: when the entry point returns,
+ * the task is marked as done and the context goes back to the executor (uc_link)
+ */
+void run_task() {
+   task_entry();
+   tasks[current_task].done = 1;
+}
+
+void executor_init(int count, void (*entry)(void), void (*switch_in)(int), void (*switch_out)(int), void (*between)(void)) {
+   int i;
+
+   tasks_count = count;
+   task_entry = entry;
+   task_switch_in = switch_in;
+   task_switch_out = switch_out;
+   executor_between = between;
+
+   tasks = malloc(count * sizeof(struct task));
+   timer_heap = malloc(count * sizeof(int));
+
+   for(i=0; i<count; i++) {
+      tasks[i].stack = malloc(EXECUTOR_STACK_SIZE);
+      tasks[i].wake = 0;
+      tasks[i].done = 0;
+      getcontext(&tasks[i].context);
+      tasks[i].context.uc_stack.ss_sp = tasks[i].stack;
+      tasks[i].context.uc_stack.ss_size = EXECUTOR_STACK_SIZE;
+      tasks[i].context.uc_link = &executor_context;
+      makecontext(&tasks[i].context, run_task, 0);
+      timer_heap_push(i);
+   }
+}
+
+/*
+ * This method resumes the tasks in order of wake up time. When the first task must still
+ * sleep, the executor sleeps until its wake up time: a signal interrupts the sleep, so that
+ * "between" is called as soon as possible
+ */
+void executor_run() {
+   struct timespec wake;
+   double now;
+   int task;
+
+   while(timer_heap_size > 0) {
+      if(executor_between != NULL) {
+         executor_between();
+      }
+
+      task = timer_heap[0];
+      now = monotonic_now();
+      if(tasks[task].wake > now) {
+         wake.tv_sec = (time_t)tasks[task].wake;
+         wake.tv_nsec = (long)((tasks[task].wake - wake.tv_sec) * 1e9);
+         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+         continue;
+      }
+
+      timer_heap_pop();
+      current_task = task;
+      task_switch_in(task);
+      swapcontext(&executor_context, &tasks[task].context);
+      task_switch_out(task);
+      current_task = -1;
+
+      if(!tasks[task].done) {
+         timer_heap_push(task);
+      }
+   }
+}
+
+void executor_sleep(double seconds) {
+   int task = current_task;
+
+   tasks[task].wake = monotonic_now() + seconds;
+   swapcontext(&tasks[task].context, &executor_context);
+}
+
+int executor_current() {
+   return current_task;
+}
+
+void executor_free() {
+   int i;
+
+   for(i=0; i<tasks_count; i++) {
+      free(tasks[i].stack);
+   }
+   free(tasks);
+   free(timer_heap);
+}
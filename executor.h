@@ -0,0 +1,56 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <ucontext.h>
+
+/* Size of the stack of each task */
+#define EXECUTOR_STACK_SIZE (64 * 1024)
+
+/*
+ * Interval (in seconds) after which a task that is waiting for an IPC operation
+ * that would block (see ship_yield) tries it again: the interval doubles at each 
+ * attempt, up to the maximum, so that the long waits don't keep the processor busy
+ */
+#define EXECUTOR_POLL_INTERVAL 0.001
+#define EXECUTOR_POLL_MAX_INTERVAL 0.064
+
+/*
+ *
+ * The executor runs many tasks (coroutines) in a single process. A task runs until it calls
+ * executor_sleep, then the executor resumes the task with the earliest wake up time: the
+ * sleeping tasks are kept in a min-heap ordered by wake up time, so the executor only
+ * sleeps when no task can run. There is no preemption: a task is never suspended in the middle of
+ * an operation, unless it calls executor_sleep.
+ *    - the context of the task (registers and stack)
+ *    - the instant (CLOCK_MONOTONIC, in seconds) in which the task has to be resumed
+ *    - 1 if the task returned from its entry point, 0 otherwise
+ *
+ */
+struct task {
+   ucontext_t context;
+   char *stack;
+   double wake;
+   int done;
+};
+
+/*
+ * Creates the given number of tasks, all of them starting from "entry". Before a task is resumed
+ * the executor calls "switch_in" with the index of the task, after the task suspends itself
+ * it calls "switch_out": they are used to load and save the state of the task. "between" is
+ * called by the executor before resuming each task, outside of every task (it can be NULL)
+ */
+void executor_init(int, void (*)(void), void (*)(int), void (*)(int), void (*)(void));
+
+/* Runs the tasks until all of them returned from their entry point */
+void executor_run();
+
+/* Suspends the running task for the given seconds */
+void executor_sleep(double);
+
+/* Returns the index of the running task, -1 if the executor is not running a task */
+int executor_current();
+
+/* Frees the tasks */
+void executor_free();
+
+#endif
@@ -0,0 +1,104 @@
+#include "utils.h"
+#include "export.h"
+
+FILE *export_file = NULL;
+int export_format;
+char *export_buffer;
+
+/* Names of the kinds of records and of their fields (see EXPORT_SHIPS) */
+const char *export_kinds[EXPORT_KINDS] = {"ships", "port", "product", "top_ports", "ipc", 
+   "quays", "quay_times", "ship_usage", "lanes", "skew", "rusage"};
+
+const char *export_fields[EXPORT_KINDS][EXPORT_MAX_FIELDS + 1] = {
+   {"empty", "loaded", "in_port", NULL},
+   {"port", "pid", "occupied_quays", "total_quays", "inbound", "waiting",
+      "tons_available", "tons_shipped", "tons_delivered", "tons_expired", NULL},
+   {"product", "generated", "available_port", "expired_port", "on_ship", "expired_ship", "delivered", NULL},
+   {"product", "top_offering_port", "top_demanding_port", NULL},
+   {"role", "call", "calls", "failed", "total_ns", "max_ns", "p50_ns", "p99_ns", NULL},
+   {"port", "time_ms", "waiting", "inbound", "occupied_quays", NULL},
+   {"port", "docks", "wait_p50_us", "wait_p99_us", "wait_max_us", "hold_p50_us", "hold_p99_us", "hold_max_us", NULL},
+   {"ship", "sailing_loaded_ms", "sailing_empty_ms", "waiting_ms", "exchanging_ms", "ton_distance", 
+      "delivered", "expired", "failed_reservations", NULL},
+   {"rank", "origin", "destination", "tons", "voyages", "mean_transit_ms", NULL},
+   {"kind", "sleeps", "missed", "p50_us", "p99_us", "max_us", NULL},
+   {"role", "processes", "user_ms", "sys_ms", "voluntary_switches", "involuntary_switches", 
+      "max_rss_kb", "minor_faults", NULL}
+};
+
+int export_open(char *path, int format) {
+   unsigned int schema = EXPORT_SCHEMA_VERSION;
+   int i, j;
+
+   export_file = fopen(path, format == EXPORT_BINARY ? "wb" : "w");
+   if(export_file == NULL) {
+      return -1;
+   }
+   export_format = format;
+   export_buffer = malloc(EXPORT_BUFFER_SIZE);
+   setvbuf(export_file, export_buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+
+   if(format == EXPORT_CSV) {
+      for(i=0; i<EXPORT_KINDS; i++) {
+         fprintf(export_file, "#%s,schema,day", export_kinds[i]);
+         for(j=0; export_fields[i][j] != NULL; j++) {
+            fprintf(export_file, ",%s", export_fields[i][j]);
+         }
+         fputc('\n', export_file);
+      }
+   } else if(format == EXPORT_BINARY) {
+      fwrite("SOEX", 1, 4, export_file);
+      fwrite(&schema, sizeof(schema), 1, export_file);
+   }
+
+   return 0;
+}
+
+int export_enabled() {
+   return export_file != NULL;
+}
+
+void export_record(int kind, int day, long *values) {
+   struct export_binary_header header;
+   int64_t fields[EXPORT_MAX_FIELDS];
+   int i;
+
+   switch(export_format) {
+      case EXPORT_CSV:
+         fprintf(export_file, "%s,%d,%d", export_kinds[kind], EXPORT_SCHEMA_VERSION, day);
+         for(i=0; export_fields[kind][i] != NULL; i++) {
+            fprintf(export_file, ",%ld", values[i]);
+         }
+         fputc('\n', export_file);
+         break;
+      case EXPORT_JSONL:
+         fprintf(export_file, "{\"kind\":\"%s\",\"schema\":%d,\"day\":%d", export_kinds[kind], EXPORT_SCHEMA_VERSION, day);
+         for(i=0; export_fields[kind][i] != NULL; i++) {
+            fprintf(export_file, ",\"%s\":%ld", export_fields[kind][i], values[i]);
+         }
+         fputs("}\n", export_file);
+         break;
+      case EXPORT_BINARY:
+         header.schema = EXPORT_SCHEMA_VERSION;
+         header.kind = kind;
+         header.day = day;
+         for(i=0; export_fields[kind][i] != NULL; i++) {
+            fields[i] = values[i];
+         }
+         fwrite(&header, sizeof(header), 1, export_file);
+         fwrite(fields, sizeof(int64_t), i, export_file);
+         break;
+      default:
+         break;
+   }
+}
+
+void export_flush() {
+   fflush(export_file);
+}
+
+void export_close() {
+   fclose(export_file);
+   free(export_buffer);
+   export_file = NULL;
+}
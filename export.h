@@ -0,0 +1,81 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+
+/* Version of the layout of the exported records, written in every record */
+#define EXPORT_SCHEMA_VERSION 7
+
+/* Size of the buffer of the export file: the records of a day are written with few syscalls */
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+/* Formats of the export file (see --format) */
+#define EXPORT_CSV 0
+#define EXPORT_JSONL 1
+#define EXPORT_BINARY 2
+
+/*
+ * Kinds of the exported records, the fields of each kind are listed in export.c:
+ *    - EXPORT_SHIPS: the ships empty, loaded and in a port (one record a day)
+ *    - EXPORT_PORT: the stats of a port (one record for each port a day)
+ *    - EXPORT_PRODUCT: the stats of a product (one record for each product a day)
+ *    - EXPORT_TOP_PORTS: the top offering and demanding ports of a product (at the end)
+ *    - EXPORT_IPC: the IPC calls of a role (IPC_ROLE_MASTER...) of a kind (IPC_CALL_SEMOP...), 
+ *      with the latencies in ns (at the end, one record for each call made at least once)
+ *    - EXPORT_QUAYS: a sample of the quays of a port, taken every QUAY_SAMPLE_INTERVAL ms
+ *    - EXPORT_QUAY_TIMES: the times the ships waited for a quay of a port and held it, 
+ *      in microseconds (at the end)
+ *    - EXPORT_SHIP_USAGE: how a ship spent the simulation, with the times in milliseconds (at the end)
+ *    - EXPORT_LANES: one of the LANE_TOP lanes that carried the most tons, with its rank
+ *      and the mean transit in milliseconds (at the end)
+ *    - EXPORT_SKEW: the delays of a kind of sleep (SKEW_VOYAGE...) in microseconds (at the end)
+ *    - EXPORT_RUSAGE: the resources used by the processes of a role (IPC_ROLE_MASTER...), 
+ *      with the CPU times in milliseconds (at the end)
+ */
+#define EXPORT_SHIPS 0
+#define EXPORT_PORT 1
+#define EXPORT_PRODUCT 2
+#define EXPORT_TOP_PORTS 3
+#define EXPORT_IPC 4
+#define EXPORT_QUAYS 5
+#define EXPORT_QUAY_TIMES 6
+#define EXPORT_SHIP_USAGE 7
+#define EXPORT_LANES 8
+#define EXPORT_SKEW 9
+#define EXPORT_RUSAGE 10
+#define EXPORT_KINDS 11
+
+/* Maximum number of fields of a record */
+#define EXPORT_MAX_FIELDS 10
+
+/*
+ *
+ * The CSV file starts with a line for each kind of record, "#kind,schema,day," followed by the
+ * names of its fields, then each record is a line "kind,schema,day," followed by its fields.
+ * Each line of the JSON Lines file is an object with the kind, the schema, the day and the fields.
+ * The binary file starts with the magic "SOEX" and the schema (uint32), then each record is
+ * its header followed by its fields (int64), in the byte order of the machine
+ *
+ */
+struct export_binary_header {
+   unsigned short schema;
+   unsigned short kind;
+   int day;
+};
+
+/* Opens the export file with the given path and format, returns -1 if it can't be opened */
+int export_open(char *, int);
+
+/* Returns 1 if the export file is open, 0 otherwise */
+int export_enabled();
+
+/* Writes a record of the given kind and day, with the fields of its kind */
+void export_record(int, int, long *);
+
+/* Writes the buffered records to the export file */
+void export_flush();
+
+/* Closes the export file */
+void export_close();
+
+#endif
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "export.h"
 
 /* Variables and structs */
 pid_t* ports_pids;
@@ -10,9 +11,60 @@ pid_t* ships_pids;
 char **port_params, **ship_params;
 
 int shm_id, ship_stats_shm_id, ports_stats_shm_id, prod_stats_shm_id;
-int sem_synch_id;
+int header_shm_id, calendar_shm_id, queues_shm_id, ship_slots_shm_id, lots_shm_id;
+int catalogue_shm_id, product_index_shm_id, catalogue_stride;
+int sem_synch_id, quays_lock_id;
+
+/* The number of semaphores of each array that wakes up the waiting ships (see SHIP_SEM_SETS) */
+int ships_per_sem_set;
 int current_day = 0, ended = 0;
 
+/* 
+ * The number of ship processes (SO_NAVI, or SO_EXECUTORS in executor mode) 
+ * and of port processes (SO_PORTI, or 1 if SO_PORT_THREADS is set)
+ */
+int ship_processes, port_processes;
+
+/* 
+ * The instants (CLOCK_MONOTONIC) in which the creation of the ports and the ships 
+ * started and in which the first day ended, used to report the startup time
+ */
+struct timespec spawn_start, first_tick;
+
+/* How much of the stats is printed each day (see --report) */
+int report_mode = REPORT_FULL;
+
+/* The seed given by --seed, 0 to keep SO_SEED (see struct config_variables) */
+unsigned long seed = 0;
+
+/* 
+ * The trace file (see --trace), the trace rings in shared memory, the timer that 
+ * drains them and the number of events written to the file
+ */
+FILE *trace_file = NULL;
+char *trace_buffer;
+struct trace_ring *trace_rings;
+int trace_shm_id, trace_timer_fd;
+unsigned long traced_events = 0;
+
+/*
+ * The master runs an event loop (epoll) over the timer of the days, the timer of the samples
+ * of the quays, the signalfd of SIGINT and SIGTERM and the pidfds of the ports and of the ships 
+ * (see EVENT_DAY_TIMER). The pidfds are SO_PORTI + SO_NAVI, -1 for the processes that are not watched
+ */
+int epoll_fd, day_timer_fd, quay_timer_fd, signal_fd;
+int *pidfds;
+
+/* The mask of the master (SIGINT and SIGTERM blocked) and the one restored by the children */
+sigset_t master_mask, children_mask;
+
+/* 
+ * Jitter of the day clock: the delay between the deadline of each day 
+ * (a whole number of seconds after the simulation start) and its handling
+ */
+double tick_jitter_sum = 0, tick_jitter_max = 0;
+int ticks = 0;
+
 struct config_variables my_config_variables;
 
 /*
@@ -21,6 +73,13 @@ struct config_variables my_config_variables;
  */
 struct port_info *ports_infos;
 
+/*
+ * The catalogues of the ports and the lists of the catalogue elements of each product,
+ * in shared memory (see struct shared_header)
+ */
+struct product *catalogue;
+int *product_index;
+
 /* 
  * This array will contain the stats about the ships. The array will have 3 elements:
  * - In first (0) position there will be the counter of the empty ships
@@ -33,77 +92,265 @@ struct port_stats *all_ports_stats;
 
 struct prod_stats *all_products_stats;
 
+/* 
+ * The consistent copy of the stats taken by take_stats_snapshot, 
+ * the daily report is printed from here
+ */
+int ships_snapshot[3];
+struct port_stats *ports_snapshot;
+struct prod_stats *products_snapshot;
+
+/* 1 if the copy of the current day might be torn (see take_stats_snapshot), and the days it was */
+int snapshot_torn = 0, torn_snapshots = 0;
+
+struct shared_header *shared_header;
+
+/*
+ * This array will be in shared memory and will contain the quays calendar:
+ * SO_BANCHINE elements for each port (see struct shared_header)
+ */
+double *quays_calendar;
+
+/* Admission queues of the ports and slots of the ships, in shared memory */
+struct quays_queue *quays_queues;
+struct ship_slot *ship_slots;
+
+/* 
+ * Times of the quays of each port recorded by the ships (see struct quay_stats) and the samples
+ * of the quays taken by the master: for each port the sums of the ships waiting for a quay and
+ * of the occupied quays, the longest queue, and the number of samples
+ */
+struct quay_stats *quay_stats;
+long *waiting_sum, *occupied_sum;
+int *waiting_max;
+unsigned long quay_samples = 0;
+
+/* How each ship spent the simulation, in shared memory (see struct ship_usage) */
+struct ship_usage *ships_usage;
+
+/* 
+ * The pool of the lanes added by the ship processes, in shared memory (see struct lane), 
+ * and the lanes merged by the master at the end, ordered by tons
+ */
+struct lane *lanes_pool, *lanes;
+int lanes_count = 0;
+
+/* The resources used by each port and ship process, taken when it's reaped (see struct process_usage) */
+struct process_usage *processes_usage;
+int processes_count = 0;
+
 /* Methods */
 
-void choose_config();
+void choose_config(int);
 void master_malloc_and_ipcs();
 void signal_to_everyone(int);
 void free_existing_data_structures();
+void build_product_index();
 void find_best_ports();
 void print_stats();
+void take_stats_snapshot();
+void copy_stats();
+void print_full_report();
+void print_summary();
+void export_stats();
 void check_global_offer();
-
-int main(void) {
+void setup_event_loop();
+void watch_processes();
+void start_day_timer();
+void run_event_loop();
+void new_day();
+void process_exited(int);
+void end_simulation(int);
+void reap_processes();
+int create_header();
+int register_ipc(int, int);
+void remove_ipc_objects(struct shared_header *);
+int cleanup_run(key_t);
+void setup_tracing();
+void drain_traces();
+unsigned long lost_traces();
+unsigned long ipc_percentile(struct ipc_call_stats *, double);
+void print_ipc_stats();
+void export_ipc_stats();
+void sample_quays();
+void print_quay_stats();
+void export_quay_stats();
+double ship_usage_value(struct ship_usage *, int);
+int compare_doubles(const void *, const void *);
+void print_ship_usage();
+void export_ship_usage();
+int compare_lanes_by_port(const void *, const void *);
+int compare_lanes_by_tons(const void *, const void *);
+void merge_lanes();
+void print_lanes();
+void export_lanes();
+void print_skew_stats();
+void export_skew_stats();
+void account_process(pid_t, struct rusage *);
+void fill_process_usage(struct process_usage *, struct rusage *);
+void rusage_totals(struct process_usage *, int *);
+int compare_processes_by_cpu(const void *, const void *);
+void print_rusage_stats();
+void export_rusage_stats();
+
+int main(int argc, char *argv[]) {
    pid_t pid_port, pid_ship;
-   int i, j, ris;
-   char *args[] = {NULL};
-   struct sigaction sa;
-   struct timespec my_timeout;
+   int i, ports_to_fork, ships_to_fork, option, export_format = EXPORT_CSV, config = 0;
+   char *args[] = {NULL}, *export_path = NULL, *trace_path = NULL;
    struct sembuf ports_and_ships_sync;
+   struct random_state world_random;
+   static struct option options[] = {
+      {"cleanup", no_argument, NULL, 'c'},
+      {"config", required_argument, NULL, 'n'},
+      {"export", required_argument, NULL, 'e'},
+      {"format", required_argument, NULL, 'f'},
+      {"report", required_argument, NULL, 'r'},
+      {"seed", required_argument, NULL, 's'},
+      {"trace", required_argument, NULL, 't'},
+      {NULL, 0, NULL, 0}
+   };
+
+   /* 
+    * --cleanup removes the IPC objects left in this directory by a run that crashed,
+    * --export writes the stats of each day to the given file in the given --format
+    * (csv, jsonl or binary), --report chooses the text report (full, summary or none),
+    * --trace writes the events of the ports and of the ships to the given file (see trace2json),
+    * --config chooses the configuration (1-10) without asking it, --seed overrides SO_SEED, 
+    * so that the ports, their products and the ships start the same in every run with that seed
+    */
+   while((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+      switch(option) {
+         case 'c':
+            return cleanup_run(ftok(".", IPC_REGISTRY_PROJ)) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+         case 'e':
+            export_path = optarg;
+            break;
+         case 'n':
+            config = atoi(optarg);
+            if(config < 1 || config > 10) {
+               fprintf(stderr, "Unknown config %s (1-10)\n", optarg);
+               return EXIT_FAILURE;
+            }
+            break;
+         case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+         case 'f':
+            if(strcmp(optarg, "csv") == 0) {
+               export_format = EXPORT_CSV;
+            } else if(strcmp(optarg, "jsonl") == 0) {
+               export_format = EXPORT_JSONL;
+            } else if(strcmp(optarg, "binary") == 0) {
+               export_format = EXPORT_BINARY;
+            } else {
+               fprintf(stderr, "Unknown format %s (csv, jsonl or binary)\n", optarg);
+               return EXIT_FAILURE;
+            }
+            break;
+         case 'r':
+            if(strcmp(optarg, "full") == 0) {
+               report_mode = REPORT_FULL;
+            } else if(strcmp(optarg, "summary") == 0) {
+               report_mode = REPORT_SUMMARY;
+            } else if(strcmp(optarg, "none") == 0) {
+               report_mode = REPORT_NONE;
+            } else {
+               fprintf(stderr, "Unknown report %s (full, summary or none)\n", optarg);
+               return EXIT_FAILURE;
+            }
+            break;
+         case 't':
+            trace_path = optarg;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [--cleanup] [--config 1-10] [--seed SEED] [--export FILE [--format csv|jsonl|binary]] "
+               "[--report full|summary|none] [--trace FILE]\n", argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
 
-   /* Signals and Nanosleep setup */
-   bzero(&sa, sizeof(sa));
-   sa.sa_handler = handle_signal;
-   sigaction(SIGALRM, &sa, NULL);
-   sigaction(SIGINT, &sa, NULL);
-   sigaction(SIGTERM, &sa, NULL);
+   if(export_path != NULL && export_open(export_path, export_format) == -1) {
+      perror("export file open failed!");
+      return EXIT_FAILURE;
+   }
+   if(trace_path != NULL && (trace_file = fopen(trace_path, "wb")) == NULL) {
+      perror("trace file open failed!");
+      return EXIT_FAILURE;
+   }
 
-   my_timeout.tv_sec = 1;
+   /* Signals and event loop setup */
+   setup_event_loop();
 
    /* Config choice, Malloc for arrays of pids, array of structs and shared memory */
-   choose_config();
+   choose_config(config);
+
+   /* The timer slack is inherited by every port and ship, through fork and execve */
+   if(my_config_variables.SO_TIMER_SLACK > 0) {
+      prctl(PR_SET_TIMERSLACK, (unsigned long)my_config_variables.SO_TIMER_SLACK, 0, 0, 0);
+   }
    
    master_malloc_and_ipcs();
 
    /* Ports and ships creation */
 
+   random_seed(&world_random, my_config_variables.SO_SEED, IPC_ROLE_MASTER, 0);
+
+   /*
+    * In zygote mode only one port and one ship are started, then they fork the others: 
+    * the master becomes their subreaper, so that it can still wait for all of them
+    */
+   if(my_config_variables.SO_ZYGOTE) {
+      prctl(PR_SET_CHILD_SUBREAPER, 1);
+      ports_to_fork = 1;
+      ships_to_fork = 1;
+   } else {
+      ports_to_fork = port_processes;
+      ships_to_fork = ship_processes;
+   }
+
    for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      if(i < 4) { /* Disposing 4 ports in the corners of the map */
+         if(i==0) {
+            ports_infos[i].coord_x = 0.00;
+            ports_infos[i].coord_y = 0.00;
+         } else {
+            if(i==1) {
+               ports_infos[i].coord_x = 0.00;
+               ports_infos[i].coord_y = my_config_variables.SO_LATO;
+            } else {
+               if(i==2) {
+                  ports_infos[i].coord_x = my_config_variables.SO_LATO;
+                  ports_infos[i].coord_y = 0.00;
+               } else {
+                  ports_infos[i].coord_x = my_config_variables.SO_LATO;
+                  ports_infos[i].coord_y = my_config_variables.SO_LATO;
+               }
+            }
+         }
+      } else {
+         ports_infos[i].coord_x = random_unit(&world_random) * my_config_variables.SO_LATO;
+         ports_infos[i].coord_y = random_unit(&world_random) * my_config_variables.SO_LATO;
+      }
+   }
+
+   /*
+    * Each port takes its own index from the counter in the shared header and
+    * writes its pid in the correspondent element of ports_infos
+    */
+   clock_gettime(CLOCK_MONOTONIC, &spawn_start);
+   for(i=0; i<ports_to_fork; i++) {
       pid_port = fork();
       
-      srand(pid_port);
-      
       if(pid_port == -1) {
          perror("fork failed!");
          exit(EXIT_FAILURE);
       } else if(pid_port == 0) {
+         sigprocmask(SIG_SETMASK, &children_mask, NULL);
          execve("./port", args, port_params);
          perror("execve ports error");
          exit(EXIT_FAILURE);
       } else {
          ports_pids[i] = pid_port;
-         if(i < 4) { /* Disposing 4 ports in the corners of the map */
-            if(i==0) {
-               ports_infos[i].coord_x = 0.00;
-               ports_infos[i].coord_y = 0.00;
-            } else {
-               if(i==1) {
-                  ports_infos[i].coord_x = 0.00;
-                  ports_infos[i].coord_y = my_config_variables.SO_LATO;
-               } else {
-                  if(i==2) {
-                     ports_infos[i].coord_x = my_config_variables.SO_LATO;
-                     ports_infos[i].coord_y = 0.00;
-                  } else {
-                     ports_infos[i].coord_x = my_config_variables.SO_LATO;
-                     ports_infos[i].coord_y = my_config_variables.SO_LATO;
-                  }
-               }
-            }
-         } else {
-            ports_infos[i].coord_x = (float)rand() / RAND_MAX * my_config_variables.SO_LATO;
-            ports_infos[i].coord_y = (float)rand() / RAND_MAX * my_config_variables.SO_LATO;
-         }
-         ports_infos[i].port_pid = pid_port;
       }
    }
 
@@ -118,16 +365,27 @@ int main(void) {
    ports_and_ships_sync.sem_op = 0;
    ports_and_ships_sync.sem_flg = 0;
 
-   semop(sem_synch_id, &ports_and_ships_sync, 1);
+   ipc_semop(sem_synch_id, &ports_and_ships_sync, 1);
+
+   /* A process hosting many ports (see SO_PORT_THREADS) is signaled once */
+   if(my_config_variables.SO_ZYGOTE) {
+      for(i=0; i<my_config_variables.SO_PORTI; i++) {
+         if(i == 0 || ports_infos[i].port_pid != ports_infos[i-1].port_pid) {
+            ports_pids[i] = ports_infos[i].port_pid;
+         }
+      }
+   }
 
+   build_product_index();
    find_best_ports();
 
-   for(i=0; i<my_config_variables.SO_NAVI; i++) {
+   for(i=0; i<ships_to_fork; i++) {
       pid_ship = fork();
       if(pid_ship == -1) { 
          perror("fork failed!");
          exit(EXIT_FAILURE);
       } else if(pid_ship == 0) { 
+         sigprocmask(SIG_SETMASK, &children_mask, NULL);
          execve("./ship", args, ship_params);
          perror("execve ships error");
          exit(EXIT_FAILURE);
@@ -145,7 +403,16 @@ int main(void) {
    ports_and_ships_sync.sem_op = 0;
    ports_and_ships_sync.sem_flg = 0;
    
-   semop(sem_synch_id, &ports_and_ships_sync, 1);
+   ipc_semop(sem_synch_id, &ports_and_ships_sync, 1);
+
+   /* An executor hosts a contiguous range of ships, its pid is kept only once */
+   if(my_config_variables.SO_ZYGOTE) {
+      for(i=0; i<my_config_variables.SO_NAVI; i++) {
+         if(i == 0 || ship_slots[i].ship_pid != ship_slots[i-1].ship_pid) {
+            ships_pids[i] = ship_slots[i].ship_pid;
+         }
+      }
+   }
 
    /* Simulation start */
 
@@ -153,42 +420,36 @@ int main(void) {
    ports_and_ships_sync.sem_op = my_config_variables.SO_NAVI + my_config_variables.SO_PORTI;
    ports_and_ships_sync.sem_flg = 0;
 
-   alarm(my_config_variables.SO_DAYS);
+   watch_processes();
 
-   semop(sem_synch_id, &ports_and_ships_sync, 1);
-   
-   for(i=0; i<my_config_variables.SO_DAYS-1; i++) {
-      nanosleep(&my_timeout, NULL);
-      signal_to_everyone(SIGUSR2);
-      check_global_offer();
-      current_day++;
-      print_stats();
-   }
-      
-   /* Simulation ended*/
-   for(i=0; i<my_config_variables.SO_NAVI + my_config_variables.SO_PORTI; i++) {
-      waitpid(-1, NULL, 0);
-   }
+   clock_gettime(CLOCK_MONOTONIC, &shared_header->sim_start);
+   start_day_timer();
+   ipc_semop(sem_synch_id, &ports_and_ships_sync, 1);
 
-   free_existing_data_structures();
+   /* The simulation ends inside the event loop (see end_simulation) */
+   run_event_loop();
    return 0;
 }
 
 /*
- * This method is used to decide which configuration will be used during the simulation
+ * This method is used to decide which configuration will be used during the simulation:
+ * the given one, or the one chosen by the user if it's 0
  */
-void choose_config() {
-   int choice, cont = 0;
+void choose_config(int choice) {
+   int cont = 0;
    do {
-      printf("Please choose a configuration, digit the correspondent number:\n");
-      printf("1. Lots of small ships, a few ports, lots of products\n");
-      printf("2. Lots of big ships, a few ports, lots of products\n");
-      printf("3. A few small ships, lots of ports, lots of products\n");
-      printf("4. A few big ships, lots of ports, lots of products\n");
-      printf("5. Lots of small ships, lots of ports, lots of products\n");
-      printf("\nChoice: ");
-      scanf("%d", &choice);
-      printf("\n\n\n");
+      if(choice == 0) {
+         printf("Please choose a configuration, digit the correspondent number:\n");
+         printf("1. Lots of small ships, a few ports, lots of products\n");
+         printf("2. Lots of big ships, a few ports, lots of products\n");
+         printf("3. A few small ships, lots of ports, lots of products\n");
+         printf("4. A few big ships, lots of ports, lots of products\n");
+         printf("5. Lots of small ships, lots of ports, lots of products\n");
+         printf("6-10. The configurations 1-5 with the quantities (tons) scaled up 100 times\n");
+         printf("\nChoice: ");
+         scanf("%d", &choice);
+         printf("\n\n\n");
+      }
 
       switch (choice) {
          case 1:
@@ -215,9 +476,35 @@ void choose_config() {
             my_config_variables = setup_config_variables("file_config5.txt");
             cont = 1;
             break;
+
+         case 6:
+            my_config_variables = setup_config_variables("file_config6.txt");
+            cont = 1;
+            break;
+
+         case 7:
+            my_config_variables = setup_config_variables("file_config7.txt");
+            cont = 1;
+            break;
+
+         case 8:
+            my_config_variables = setup_config_variables("file_config8.txt");
+            cont = 1;
+            break;
+
+         case 9:
+            my_config_variables = setup_config_variables("file_config9.txt");
+            cont = 1;
+            break;
+
+         case 10:
+            my_config_variables = setup_config_variables("file_config10.txt");
+            cont = 1;
+            break;
          
          default:
-            printf("\t\tError, please digit a valid number (1-5)\n\n");
+            printf("\t\tError, please digit a valid number (1-10)\n\n");
+            choice = 0;
             break;
       }
    } while(!cont);
@@ -232,6 +519,11 @@ struct config_variables setup_config_variables(char* configuration_file) {
    char buffer[100];
    char *var_name, *var_value;
    struct config_variables my_config_variables;
+   struct timespec now;
+   struct seminfo limits;
+   union semun semctl_arg;
+
+   bzero(&my_config_variables, sizeof(my_config_variables));
 
    if (file == NULL) {
       printf("Error while opening the file. \n");
@@ -265,14 +557,73 @@ struct config_variables setup_config_variables(char* configuration_file) {
       else if (strcmp(var_name, "SO_BANCHINE") == 0)
          my_config_variables.SO_BANCHINE = atoi(var_value);
       else if (strcmp(var_name, "SO_FILL") == 0)
-         my_config_variables.SO_FILL = atof(var_value);
+         my_config_variables.SO_FILL = atol(var_value);
       else if (strcmp(var_name, "SO_LOADSPEED") == 0)
          my_config_variables.SO_LOADSPEED = atoi(var_value);
       else if (strcmp(var_name, "SO_DAYS") == 0)
          my_config_variables.SO_DAYS = atoi(var_value);
+      else if (strcmp(var_name, "SO_GEN_PERIOD") == 0)
+         my_config_variables.SO_GEN_PERIOD = atoi(var_value);
+      else if (strcmp(var_name, "SO_GEN_FILL") == 0)
+         my_config_variables.SO_GEN_FILL = atoi(var_value);
+      else if (strcmp(var_name, "SO_ACTIVE_MERCI") == 0)
+         my_config_variables.SO_ACTIVE_MERCI = atoi(var_value);
+      else if (strcmp(var_name, "SO_ZYGOTE") == 0)
+         my_config_variables.SO_ZYGOTE = atoi(var_value);
+      else if (strcmp(var_name, "SO_EXECUTORS") == 0)
+         my_config_variables.SO_EXECUTORS = atoi(var_value);
+      else if (strcmp(var_name, "SO_PORT_THREADS") == 0)
+         my_config_variables.SO_PORT_THREADS = atoi(var_value);
+      else if (strcmp(var_name, "SO_TIMER_SLACK") == 0)
+         my_config_variables.SO_TIMER_SLACK = atol(var_value);
+      else if (strcmp(var_name, "SO_SEED") == 0)
+         my_config_variables.SO_SEED = strtoul(var_value, NULL, 10);
    }
    fclose(file);
 
+   /* A run without a seed gets one, reported so that it can be repeated */
+   if(seed != 0) {
+      my_config_variables.SO_SEED = seed;
+   }
+   if(my_config_variables.SO_SEED == 0) {
+      clock_gettime(CLOCK_REALTIME, &now);
+      my_config_variables.SO_SEED = random_mix(now.tv_sec ^ ((uint64_t)now.tv_nsec << 32) ^ getpid());
+   }
+   printf("Seed: %lu\n", my_config_variables.SO_SEED);
+
+   if(my_config_variables.SO_EXECUTORS < 0) {
+      my_config_variables.SO_EXECUTORS = (int)sysconf(_SC_NPROCESSORS_ONLN);
+   }
+   if(my_config_variables.SO_EXECUTORS > my_config_variables.SO_NAVI) {
+      my_config_variables.SO_EXECUTORS = my_config_variables.SO_NAVI;
+   }
+
+   /*
+    * The ships are split among at most SHIP_SEM_SETS arrays of SEMMSL semaphores, while the
+    * synch semaphore counts the ports and the ships, so neither can exceed SEMVMX
+    */
+   semctl_arg.__buf = &limits;
+   if(semctl(0, 0, IPC_INFO, semctl_arg) == -1) {
+      limits.semmsl = 250;
+      limits.semvmx = 32767;
+   }
+   ships_per_sem_set = limits.semmsl;
+   if(my_config_variables.SO_NAVI > limits.semvmx || my_config_variables.SO_PORTI > limits.semvmx) {
+      fprintf(stderr, "SO_NAVI is %d and SO_PORTI is %d, but a semaphore of the system counts "
+         "at most %d (SEMVMX)\n", my_config_variables.SO_NAVI, my_config_variables.SO_PORTI,
+         limits.semvmx);
+      exit(EXIT_FAILURE);
+   }
+   if(my_config_variables.SO_NAVI > (long)ships_per_sem_set * SHIP_SEM_SETS) {
+      fprintf(stderr, "SO_NAVI is %d, but the semaphores of the system allow at most %ld ships "
+         "(%d arrays of SEMMSL %d semaphores)\n", my_config_variables.SO_NAVI, 
+         (long)ships_per_sem_set * SHIP_SEM_SETS, SHIP_SEM_SETS, ships_per_sem_set);
+      exit(EXIT_FAILURE);
+   }
+   ship_processes = (my_config_variables.SO_EXECUTORS > 0) ? 
+      my_config_variables.SO_EXECUTORS : my_config_variables.SO_NAVI;
+   port_processes = (my_config_variables.SO_PORT_THREADS > 0) ? 1 : my_config_variables.SO_PORTI;
+
    return my_config_variables;
 }
 
@@ -280,43 +631,155 @@ struct config_variables setup_config_variables(char* configuration_file) {
  * This method handles every malloc and creation of the main ipc structures 
  */
 void master_malloc_and_ipcs() {
-   int i, local_shm_id;
+   int i;
    struct sembuf my_semops[3];
+   union semun lock_arg;
+
+   /* 
+    * Shm for the header, created first with the registry key: every other IPC object
+    * is listed in its registry (see register_ipc)
+    */
+   header_shm_id = create_header();
+   shared_header->config = my_config_variables;
+   shared_header->trace_shm_id = -1;
+   if(trace_file != NULL) {
+      setup_tracing();
+   }
 
    /* Malloc and shm for ports infos */
    ports_infos = malloc(my_config_variables.SO_PORTI * sizeof(struct port_info));
-   shm_id = shmget(IPC_PRIVATE, my_config_variables.SO_PORTI * sizeof(struct port_info), IPC_CREAT | 0666);
-   ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
-   
+   shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_PORTI * sizeof(struct port_info), IPC_CREAT | 0666));
+   ports_infos = (struct port_info *)ipc_shmat(shm_id, NULL, 0);
    for(i=0; i<my_config_variables.SO_PORTI; i++) {
-      ports_infos[i].my_products_offer = malloc(my_config_variables.SO_MERCI * sizeof(struct product));
-      local_shm_id = shmget(IPC_PRIVATE, my_config_variables.SO_MERCI * sizeof(struct product), IPC_CREAT | 0666);
-      ports_infos[i].my_products_offer = (struct product *) shmat(local_shm_id, NULL, 0);
-      ports_infos[i].off_shm_id = local_shm_id;
+      ports_infos[i].msg_queue_id = -1;
+   }
+   shared_header->ports_shm_id = shm_id;
 
-      ports_infos[i].my_products_demand = malloc(my_config_variables.SO_MERCI * sizeof(struct product));
-      local_shm_id = shmget(IPC_PRIVATE, my_config_variables.SO_MERCI * sizeof(struct product), IPC_CREAT | 0666);
-      ports_infos[i].my_products_demand = (struct product *) shmat(local_shm_id, NULL, 0);
-      ports_infos[i].dem_shm_id = local_shm_id;
+   /* 
+    * Shm for the catalogues of the ports and for the index of the products.
+    * Each port trades at least 2 products, since it offers and demands at least one product
+    */
+   if(my_config_variables.SO_ACTIVE_MERCI > 0 && my_config_variables.SO_ACTIVE_MERCI < my_config_variables.SO_MERCI) {
+      catalogue_stride = (my_config_variables.SO_ACTIVE_MERCI < 2) ? 2 : my_config_variables.SO_ACTIVE_MERCI;
+   } else {
+      catalogue_stride = my_config_variables.SO_MERCI;
    }
+   catalogue_shm_id = register_ipc(IPC_OBJECT_SHM, shmget(IPC_PRIVATE, 
+      my_config_variables.SO_PORTI * catalogue_stride * sizeof(struct product), IPC_CREAT | 0666));
+   catalogue = (struct product *)ipc_shmat(catalogue_shm_id, NULL, 0);
+
+   product_index_shm_id = register_ipc(IPC_OBJECT_SHM, shmget(IPC_PRIVATE, 
+      (my_config_variables.SO_MERCI + 1 + my_config_variables.SO_PORTI * catalogue_stride) * sizeof(int), IPC_CREAT | 0666));
+   product_index = (int *)ipc_shmat(product_index_shm_id, NULL, 0);
 
    /* Mallocs and shm for stats */ 
 
    all_ships_stats = (int *)malloc(3 * sizeof(int));
-   ship_stats_shm_id = shmget(IPC_PRIVATE, 3 * sizeof(int), IPC_CREAT | 0666);
-   all_ships_stats = (int *)shmat(ship_stats_shm_id, NULL, 0);
+   ship_stats_shm_id = register_ipc(IPC_OBJECT_SHM, shmget(IPC_PRIVATE, 3 * sizeof(int), IPC_CREAT | 0666));
+   all_ships_stats = (int *)ipc_shmat(ship_stats_shm_id, NULL, 0);
 
    all_ports_stats = (struct port_stats *)malloc(my_config_variables.SO_PORTI * sizeof(struct port_stats));
-   ports_stats_shm_id = shmget(IPC_PRIVATE, my_config_variables.SO_PORTI * sizeof(struct port_stats), IPC_CREAT | 0666);
-   all_ports_stats = (struct port_stats *)shmat(ports_stats_shm_id, NULL, 0);
+   ports_stats_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_PORTI * sizeof(struct port_stats), IPC_CREAT | 0666));
+   all_ports_stats = (struct port_stats *)ipc_shmat(ports_stats_shm_id, NULL, 0);
    
    all_products_stats = (struct prod_stats *)malloc(my_config_variables.SO_MERCI * sizeof(struct prod_stats));
-   prod_stats_shm_id = shmget(IPC_PRIVATE, my_config_variables.SO_MERCI * sizeof(struct prod_stats), IPC_CREAT | 0666);
-   all_products_stats = (struct prod_stats *)shmat(prod_stats_shm_id, NULL, 0);
+   prod_stats_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_MERCI * sizeof(struct prod_stats), IPC_CREAT | 0666));
+   all_products_stats = (struct prod_stats *)ipc_shmat(prod_stats_shm_id, NULL, 0);
    
 
+   /* Shm for the quays calendar, sems for the calendar mutexes and for the quays */
+
+   shared_header->catalogue_shm_id = catalogue_shm_id;
+   shared_header->catalogue_stride = catalogue_stride;
+   shared_header->product_index_shm_id = product_index_shm_id;
+
+   calendar_shm_id = register_ipc(IPC_OBJECT_SHM, shmget(IPC_PRIVATE, 
+      my_config_variables.SO_PORTI * my_config_variables.SO_BANCHINE * sizeof(double), IPC_CREAT | 0666));
+   quays_calendar = (double *)ipc_shmat(calendar_shm_id, NULL, 0);
+   shared_header->calendar_shm_id = calendar_shm_id;
+
+   quays_lock_id = register_ipc(IPC_OBJECT_SEM, semget(IPC_PRIVATE, my_config_variables.SO_PORTI, 0600));
+   lock_arg.array = malloc(my_config_variables.SO_PORTI * sizeof(unsigned short));
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      lock_arg.array[i] = 1;
+   }
+   ipc_semctl(quays_lock_id, 0, SETALL, lock_arg);
+   free(lock_arg.array);
+   shared_header->quays_lock_id = quays_lock_id;
+
+   /* Each port sets the value of its own semaphore to the number of its quays */
+   shared_header->quays_sem_id = register_ipc(IPC_OBJECT_SEM, semget(IPC_PRIVATE, my_config_variables.SO_PORTI, 0600));
+
+   /* Shm for the admission queues and the ship slots, sems to wake up the waiting ships */
+
+   queues_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_PORTI * sizeof(struct quays_queue), IPC_CREAT | 0666));
+   quays_queues = (struct quays_queue *)ipc_shmat(queues_shm_id, NULL, 0);
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      quays_queues[i].head = -1;
+      quays_queues[i].waiting = 0;
+      quays_queues[i].inbound = 0;
+   }
+   shared_header->queues_shm_id = queues_shm_id;
+
+   ship_slots_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_NAVI * sizeof(struct ship_slot), IPC_CREAT | 0666));
+   ship_slots = (struct ship_slot *)ipc_shmat(ship_slots_shm_id, NULL, 0);
+   shared_header->ship_slots_shm_id = ship_slots_shm_id;
+
+   /* Shm for the times of the quays, recorded by the ships, and mallocs for their samples */
+   shared_header->quay_stats_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_PORTI * sizeof(struct quay_stats), IPC_CREAT | 0666));
+   quay_stats = (struct quay_stats *)ipc_shmat(shared_header->quay_stats_shm_id, NULL, 0);
+   waiting_sum = calloc(my_config_variables.SO_PORTI, sizeof(long));
+   occupied_sum = calloc(my_config_variables.SO_PORTI, sizeof(long));
+   waiting_max = calloc(my_config_variables.SO_PORTI, sizeof(int));
+
+   /* Shm for the usage of the ships */
+   shared_header->ship_usage_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, my_config_variables.SO_NAVI * sizeof(struct ship_usage), IPC_CREAT | 0666));
+   ships_usage = (struct ship_usage *)ipc_shmat(shared_header->ship_usage_shm_id, NULL, 0);
+
+   /* Shm for the pool of the lanes */
+   shared_header->lanes_size = my_config_variables.SO_PORTI * my_config_variables.SO_PORTI + 
+      my_config_variables.SO_NAVI * LANE_POOL_PER_SHIP;
+   shared_header->lanes_count = 0;
+   shared_header->lanes_lost = 0;
+   shared_header->lanes_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, shared_header->lanes_size * sizeof(struct lane), IPC_CREAT | 0666));
+   lanes_pool = (struct lane *)ipc_shmat(shared_header->lanes_shm_id, NULL, 0);
+
+   shared_header->ships_per_sem_set = ships_per_sem_set;
+   for(i=0; i*ships_per_sem_set < my_config_variables.SO_NAVI; i++) {
+      shared_header->ships_sem_ids[i] = register_ipc(IPC_OBJECT_SEM, semget(IPC_PRIVATE, 
+         (my_config_variables.SO_NAVI - i*ships_per_sem_set < ships_per_sem_set) ? 
+         my_config_variables.SO_NAVI - i*ships_per_sem_set : ships_per_sem_set, 0600));
+   }
+   shared_header->ports_count = 0;
+   shared_header->ships_count = 0;
+   shared_header->executors_count = 0;
+
+   /*
+    * Shm for the lots pool: each port can have the lots of its initial offer, that is its share
+    * of SO_FILL (SO_FILL / SO_PORTI) in lots of at most SO_SIZE tons plus a partial lot for each 
+    * product (see create_products), and, for each product of its catalogue, a lot for 
+    * each generation that can still be alive, plus the one being generated
+    */
+   shared_header->lots_per_port = my_config_variables.SO_FILL / my_config_variables.SO_PORTI / 
+      my_config_variables.SO_SIZE + catalogue_stride;
+   if(my_config_variables.SO_GEN_PERIOD > 0) {
+      shared_header->lots_per_port += catalogue_stride * 
+         (my_config_variables.SO_MAX_VITA / my_config_variables.SO_GEN_PERIOD + 1);
+   }
+   lots_shm_id = register_ipc(IPC_OBJECT_SHM, shmget(IPC_PRIVATE, 
+      my_config_variables.SO_PORTI * shared_header->lots_per_port * sizeof(struct lot), IPC_CREAT | 0666));
+   shared_header->lots_shm_id = lots_shm_id;
+
    /* Synch sem setup */
-   sem_synch_id = semget(IPC_PRIVATE, 3, 0600);
+   sem_synch_id = register_ipc(IPC_OBJECT_SEM, semget(IPC_PRIVATE, 3, 0600));
 
    bzero(my_semops,sizeof(my_semops));
 
@@ -327,7 +790,7 @@ void master_malloc_and_ipcs() {
    my_semops[2].sem_num = 2;
    my_semops[2].sem_op = 0;
 
-   semop(sem_synch_id, my_semops, 3);
+   ipc_semop(sem_synch_id, my_semops, 3);
    
    /* Mallocs for ports and ships params */
 
@@ -348,7 +811,8 @@ void master_malloc_and_ipcs() {
    sprintf(ship_params[8], "%d", ship_stats_shm_id);
    sprintf(ship_params[9], "%d", ports_stats_shm_id);
    sprintf(ship_params[10], "%d", prod_stats_shm_id);
-   ship_params[11] = NULL;
+   sprintf(ship_params[11], "%d", header_shm_id);
+   ship_params[12] = NULL;
 
    port_params = malloc(PORT_PARAMS_COUNT * sizeof(char *));  
 
@@ -364,201 +828,1332 @@ void master_malloc_and_ipcs() {
    sprintf(port_params[5], "%d", my_config_variables.SO_MIN_VITA);
    sprintf(port_params[6], "%d", my_config_variables.SO_MAX_VITA);
    sprintf(port_params[7], "%d", my_config_variables.SO_BANCHINE);
-   sprintf(port_params[8], "%d", (my_config_variables.SO_FILL / my_config_variables.SO_PORTI));
+   sprintf(port_params[8], "%ld", (my_config_variables.SO_FILL / my_config_variables.SO_PORTI));
    sprintf(port_params[9], "%d", ports_stats_shm_id);
    sprintf(port_params[10], "%d", prod_stats_shm_id);
+   sprintf(port_params[11], "%d", header_shm_id);
    port_params[12] = NULL;
 
-   ports_pids = malloc(my_config_variables.SO_PORTI * sizeof(pid_t));
-   ships_pids = malloc(my_config_variables.SO_NAVI * sizeof(pid_t));
-}
+   ports_pids = calloc(my_config_variables.SO_PORTI, sizeof(pid_t));
+   ships_pids = calloc(my_config_variables.SO_NAVI, sizeof(pid_t));
 
-void handle_signal(int signum) {
-   int i=0;
+   ports_snapshot = malloc(my_config_variables.SO_PORTI * sizeof(struct port_stats));
+   products_snapshot = malloc(my_config_variables.SO_MERCI * sizeof(struct prod_stats));
+}
 
-   switch(signum) {
-      case SIGALRM:
-         current_day++;
-         ended = 1;
-         print_stats();
-         signal_to_everyone(SIGUSR1);
-         for(i=0; i<my_config_variables.SO_NAVI + my_config_variables.SO_PORTI; i++) {
-            waitpid(-1, NULL, 0);
-         }
-         free_existing_data_structures();
-         exit(EXIT_SUCCESS);
-         break;
-      case SIGINT:
-         printf("\nMaster got SIGINT\n");
-         ended = 1;
-         print_stats();
-         signal_to_everyone(SIGINT);
-         for(i=0; i<my_config_variables.SO_NAVI + my_config_variables.SO_PORTI; i++) {
-            waitpid(-1, NULL, 0);
-         }
-         free_existing_data_structures();
-         printf("Done!\n\n\n");
-         exit(EXIT_SUCCESS);
-         break;
-      case SIGTERM:
-         printf("\nMaster got SIGTERM\n");
-         ended = 1;
-         print_stats();
-         signal_to_everyone(SIGTERM);
-         for(i=0; i<my_config_variables.SO_NAVI + my_config_variables.SO_PORTI; i++) {
-            waitpid(-1, NULL, 0);
-         }
-         free_existing_data_structures();
-         printf("Done!\n\n\n");
-         exit(EXIT_SUCCESS);
-         break;
-      default:
-         break;
+/*
+ * This method prepares the event loop. SIGINT and SIGTERM are blocked and read from a
+ * signalfd, so that the end of the simulation never runs in signal context: the children
+ * restore the original mask before the execve. The timer of the days is armed at the start
+ * of the simulation (see start_day_timer)
+ */
+void setup_event_loop() {
+   struct epoll_event event;
+
+   sigemptyset(&master_mask);
+   sigaddset(&master_mask, SIGINT);
+   sigaddset(&master_mask, SIGTERM);
+   sigprocmask(SIG_BLOCK, &master_mask, &children_mask);
+
+   epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   signal_fd = signalfd(-1, &master_mask, SFD_CLOEXEC);
+   day_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+   quay_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+   if(epoll_fd == -1 || signal_fd == -1 || day_timer_fd == -1 || quay_timer_fd == -1) {
+      perror("event loop setup failed!");
+      exit(EXIT_FAILURE);
    }
+
+   event.events = EPOLLIN;
+   event.data.fd = EVENT_SIGNALS;
+   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+   event.data.fd = EVENT_DAY_TIMER;
+   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, day_timer_fd, &event);
+   event.data.fd = EVENT_QUAY_TIMER;
+   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, quay_timer_fd, &event);
 }
 
-void signal_to_everyone(int signal) {
+/*
+ * This method opens a pidfd for each port and ship process, so that the master notices
+ * a process that exits before the end of the simulation. The limit of the open files is
+ * raised as much as allowed: when it's not enough the remaining processes are not watched
+ */
+void watch_processes() {
+   struct epoll_event event;
+   struct rlimit files;
+   pid_t pid;
    int i;
 
-   for(i=0; i<my_config_variables.SO_PORTI; i++) {
-      kill(ports_pids[i], signal);
+   if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+      files.rlim_cur = files.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &files);
    }
-   for(i=0; i<my_config_variables.SO_NAVI; i++) {
-      kill(ships_pids[i], signal);
+
+   pidfds = malloc((my_config_variables.SO_PORTI + my_config_variables.SO_NAVI) * sizeof(int));
+   for(i=0; i<my_config_variables.SO_PORTI + my_config_variables.SO_NAVI; i++) {
+      pid = i < my_config_variables.SO_PORTI ? ports_pids[i] : ships_pids[i - my_config_variables.SO_PORTI];
+      pidfds[i] = pid > 0 ? pidfd_open(pid, 0) : -1;
+      if(pidfds[i] != -1) {
+         event.events = EPOLLIN;
+         event.data.fd = i;
+         epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfds[i], &event);
+      }
    }
 }
 
-void free_existing_data_structures() {
-   int i, j;
+/*
+ * This method arms the timer of the days with absolute deadlines: the day N ends N seconds
+ * after the simulation start, however late the previous days were handled, so the days 
+ * don't drift. It's called right after the simulation start was taken, 
+ * together with the timer of the samples of the quays
+ */
+void start_day_timer() {
+   struct itimerspec days, samples;
 
-   printf("\n\nMaster about to free the memory...\n");
+   days.it_value = shared_header->sim_start;
+   days.it_value.tv_sec += 1;
+   days.it_interval.tv_sec = 1;
+   days.it_interval.tv_nsec = 0;
 
-   /* Mallocs free */
-   free(ports_pids);
-   free(ships_pids);
+   timerfd_settime(day_timer_fd, TFD_TIMER_ABSTIME, &days, NULL);
 
-   for(i=0; i<PORT_PARAMS_COUNT-1; i++) {
-      free(port_params[i]);
-   }
-   free(port_params);
+   samples.it_value.tv_sec = 0;
+   samples.it_value.tv_nsec = QUAY_SAMPLE_INTERVAL * 1000000L;
+   samples.it_interval = samples.it_value;
+   timerfd_settime(quay_timer_fd, 0, &samples, NULL);
+}
 
-   for(i=0; i<SHIP_PARAMS_COUNT-1; i++) {
-      free(ship_params[i]);
-   }
-   free(ship_params);
-   
-   /* Ipcs free */
+/*
+ * This method waits for the events of the master until the simulation ends. When the
+ * master is late, a single read of the timer returns all the days that ended
+ */
+void run_event_loop() {
+   struct epoll_event events[16];
+   struct signalfd_siginfo info;
+   uint64_t days;
+   int i, count;
+
+   while(1) {
+      count = epoll_wait(epoll_fd, events, 16, -1);
+      if(count == -1) {
+         if(errno == EINTR) {
+            continue;
+         }
+         perror("epoll_wait failed!");
+         exit(EXIT_FAILURE);
+      }
 
-   for(i=0; i<my_config_variables.SO_PORTI; i++) {
-      ports_infos[i].my_products_offer = (struct product *)shmat(ports_infos[i].off_shm_id, NULL, 0);
-      ports_infos[i].my_products_demand = (struct product *)shmat(ports_infos[i].dem_shm_id, NULL, 0);
-      for(j=0; j<my_config_variables.SO_MERCI; j++) {
-         if(ports_infos[i].my_products_offer[j].product_semaphore != -1) {
-            if(semctl(ports_infos[i].my_products_offer[j].product_semaphore, 0, IPC_RMID) == -1) {
-               printf("Free error %d with sem %d at ind %d\n", 
-                  ports_infos[i].port_pid, ports_infos[i].my_products_offer[j].product_semaphore, j);
+      for(i=0; i<count; i++) {
+         if(events[i].data.fd == EVENT_DAY_TIMER) {
+            if(read(day_timer_fd, &days, sizeof(days)) == sizeof(days)) {
+               while(days-- > 0) {
+                  new_day();
+               }
             }
-         }
-         if(ports_infos[i].my_products_demand[j].product_semaphore != -1) {
-            if(semctl(ports_infos[i].my_products_demand[j].product_semaphore, 0, IPC_RMID) == -1) {
-               printf("Free error %d with sem %d at ind %d\n", 
-                  ports_infos[i].port_pid, ports_infos[i].my_products_demand[j].product_semaphore, j);
+         } else if(events[i].data.fd == EVENT_TRACE_TIMER) {
+            if(read(trace_timer_fd, &days, sizeof(days)) == sizeof(days)) {
+               drain_traces();
+            }
+         } else if(events[i].data.fd == EVENT_QUAY_TIMER) {
+            if(read(quay_timer_fd, &days, sizeof(days)) == sizeof(days)) {
+               sample_quays();
             }
+         } else if(events[i].data.fd == EVENT_SIGNALS) {
+            if(read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+               printf("\nMaster got %s\n", info.ssi_signo == SIGINT ? "SIGINT" : "SIGTERM");
+               end_simulation(info.ssi_signo);
+            }
+         } else {
+            process_exited(events[i].data.fd);
          }
       }
    }
+}
 
-   for(i=0; i<my_config_variables.SO_PORTI; i++) {
-      shmdt(ports_infos[i].my_products_offer);
-      shmdt(ports_infos[i].my_products_demand);
+/*
+ * This method handles the end of a day: the delay from its deadline is added to the jitter
+ * of the day clock. The last day ends the simulation
+ */
+void new_day() {
+   struct timespec now;
+   double jitter;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   jitter = (now.tv_sec - shared_header->sim_start.tv_sec - (current_day + 1)) 
+      + (now.tv_nsec - shared_header->sim_start.tv_nsec) / 1e9;
+   ticks++;
+   skew_record(shared_header, SKEW_DAY_TICK, current_day + 1, current_day + 1 + jitter);
+   tick_jitter_sum += jitter;
+   if(jitter > tick_jitter_max) {
+      tick_jitter_max = jitter;
+   }
 
-      shmctl(ports_infos[i].off_shm_id, IPC_RMID, NULL);
-      shmctl(ports_infos[i].dem_shm_id, IPC_RMID, NULL);   
+   if(current_day + 1 == my_config_variables.SO_DAYS) {
+      end_simulation(SIGUSR1);
+   }
 
-      semctl(ports_infos[i].quays_id, 0, IPC_RMID);
-      msgctl(ports_infos[i].msg_queue_id, IPC_RMID, NULL);         
+   signal_to_everyone(SIGUSR2);
+   if(current_day == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &first_tick);
    }
+   check_global_offer();
+   if(ended) {
+      end_simulation(SIGUSR1);
+   }
+   current_day++;
+   print_stats();
+}
 
-   shmdt(all_ships_stats);
-   shmctl(ship_stats_shm_id, IPC_RMID, NULL);
+/*
+ * This method handles a port or a ship process (given its index, see pidfds) that exited
+ * before the end of the simulation: it's no longer signaled. The process is reaped with the others
+ */
+void process_exited(int index) {
+   if(index < my_config_variables.SO_PORTI) {
+      printf("\nPort process %d exited before the end of the simulation\n", ports_pids[index]);
+      ports_pids[index] = 0;
+   } else {
+      printf("\nShip process %d exited before the end of the simulation\n", ships_pids[index - my_config_variables.SO_PORTI]);
+      ships_pids[index - my_config_variables.SO_PORTI] = 0;
+   }
 
-   shmdt(all_ports_stats);
-   shmctl(ports_stats_shm_id, IPC_RMID, NULL);
+   close(pidfds[index]);
+   pidfds[index] = -1;
+}
 
-   shmdt(all_products_stats);
-   shmctl(prod_stats_shm_id, IPC_RMID, NULL);
+/*
+ * This method ends the simulation sending the given signal to every process: SIGUSR1 at the
+ * end of the last day (or when the offer is over), SIGINT or SIGTERM when the master got them
+ */
+void end_simulation(int signal) {
+   if(signal == SIGUSR1) {
+      current_day++;
+   }
+   ended = 1;
+   print_stats();
+   signal_to_everyone(signal);
+   reap_processes();
+
+   if(trace_file != NULL) {
+      drain_traces();
+      close(trace_timer_fd);
+      fclose(trace_file);
+      free(trace_buffer);
+      printf("\n\nTRACE STATS");
+      printf("\n\tEvents traced: %lu, lost: %lu", traced_events, lost_traces());
+      printf("\n------------\n");
+   }
 
-   semctl(sem_synch_id, 0, IPC_RMID);
-   semctl(sem_synch_id, 1, IPC_RMID);
-   semctl(sem_synch_id, 2, IPC_RMID);
+   ipc_stats_publish(shared_header, IPC_ROLE_MASTER);
+   merge_lanes();
+   if(export_enabled()) {
+      export_ship_usage();
+      export_lanes();
+      export_skew_stats();
+      export_rusage_stats();
+      export_quay_stats();
+      export_ipc_stats();
+   }
+   if(report_mode != REPORT_NONE) {
+      print_rusage_stats();
+      print_ship_usage();
+      print_lanes();
+      print_skew_stats();
+      print_quay_stats();
+      print_ipc_stats();
+   }
 
-   shmdt(ports_infos);
-   shmctl(shm_id, IPC_RMID, NULL);
+   free(pidfds);
+   free(processes_usage);
+   close(signal_fd);
+   close(epoll_fd);
 
-   printf("Free completed successfully\n");
+   free_existing_data_structures();
+   if(signal != SIGUSR1) {
+      printf("Done!\n\n\n");
+   }
+   exit(EXIT_SUCCESS);
 }
 
-void print_stats() {
-   int i;
+/*
+ * This method waits on the pidfds for the ports and the ships to exit, all together: the ones
+ * still alive after SHUTDOWN_TIMEOUT seconds are killed. Then every child is reaped, including
+ * the processes forked by the zygotes (the master is their subreaper)
+ */
+void reap_processes() {
+   struct epoll_event events[16];
+   struct signalfd_siginfo info;
+   struct timespec now, deadline;
+   struct rusage usage;
+   uint64_t expirations;
+   pid_t pid;
+   int i, count, timeout, alive = 0;
+
+   close(day_timer_fd);
+   close(quay_timer_fd);
+   for(i=0; i<my_config_variables.SO_PORTI + my_config_variables.SO_NAVI; i++) {
+      if(pidfds[i] != -1) {
+         alive++;
+      }
+   }
 
-   printf("\n\t\t\t\tSTATS ON DAY %d", current_day);
+   clock_gettime(CLOCK_MONOTONIC, &deadline);
+   deadline.tv_sec += SHUTDOWN_TIMEOUT;
+   while(alive > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      timeout = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+      if(timeout <= 0) {
+         break;
+      }
 
-   /* Ship stats */
-   printf("\n\nSHIPS STATS ON DAY %d", current_day);
-   printf("\n\tEmpty: %d", all_ships_stats[0]);
-   printf("\n\tLoaded: %d", all_ships_stats[1]);
-   printf("\n\tIn port: %d", all_ships_stats[2]);
-   printf("\n------------\n");
+      count = epoll_wait(epoll_fd, events, 16, timeout);
+      for(i=0; i<count; i++) {
+         if(events[i].data.fd >= 0) {
+            close(pidfds[events[i].data.fd]);
+            pidfds[events[i].data.fd] = -1;
+            alive--;
+         } else if(events[i].data.fd == EVENT_SIGNALS) {
+            /* The simulation is already ending */
+            read(signal_fd, &info, sizeof(info));
+         } else if(events[i].data.fd == EVENT_TRACE_TIMER) {
+            read(trace_timer_fd, &expirations, sizeof(expirations));
+            drain_traces();
+         }
+      }
+   }
 
-   /* Ports stats */
-   printf("\n\nPORTS STATS ON DAY %d", current_day);
-   for(i=0; i<my_config_variables.SO_PORTI; i++) {
-      printf("\nPort %d, quays occupied: %d / %d", ports_infos[i].port_pid, 
-         all_ports_stats[i].occupied_quays, all_ports_stats[i].total_quays);
-      printf("\n\tTons available: %d", all_ports_stats[i].tons_available);
-      printf("\n\tTons shipped: %d", all_ports_stats[i].tons_shipped);
-      printf("\n\tTons delivered: %d", all_ports_stats[i].tons_delivered);
-      printf("\n\tTons expired: %d\n", all_ports_stats[i].tons_expired);
+   if(alive > 0) {
+      printf("\n%d processes still alive after %d seconds, killing them\n", alive, SHUTDOWN_TIMEOUT);
+      for(i=0; i<my_config_variables.SO_PORTI + my_config_variables.SO_NAVI; i++) {
+         if(pidfds[i] != -1) {
+            pidfd_send_signal(pidfds[i], SIGKILL, NULL, 0);
+            close(pidfds[i]);
+            pidfds[i] = -1;
+         }
+      }
    }
-   printf("\n------------\n");
 
-   /* Products stats */
-   printf("\n\nPRODUCTS STATS ON DAY %d", current_day);
-   for(i=0; i<my_config_variables.SO_MERCI; i++) {
-      printf("\nProduct %d", i);
-      printf("\n\tAvailable in ports: %d, Expired in ports: %d", all_products_stats[i].available_port, all_products_stats[i].expired_port);
-      printf("\n\tOn ship: %d, Expired on a ship: %d", all_products_stats[i].on_ship, all_products_stats[i].expired_ship);
-      printf("\n\tDelivered: %d", all_products_stats[i].delivered);
-      if(ended) {
-         printf("\n\tTop offering port: %d, Top demanding port: %d", 
-            all_products_stats[i].top_offering_port, all_products_stats[i].top_demanding_port);
+   processes_usage = malloc((my_config_variables.SO_PORTI + my_config_variables.SO_NAVI) * sizeof(struct process_usage));
+   while((pid = wait4(-1, NULL, 0, &usage)) != -1 || errno == EINTR) {
+      if(pid > 0) {
+         account_process(pid, &usage);
       }
    }
-   printf("\n------------\n");
 }
 
-/* 
- * This method is used to find, for each product, the port that offered the most tons and
+/*
+ * This method keeps the resources used by a reaped process, if it was a port or a ship:
+ * the pids are looked up in shared memory, so the processes forked by the zygotes are found too
+ */
+void account_process(pid_t pid, struct rusage *usage) {
+   int i, role = -1, index = -1;
+
+   for(i=0; i<my_config_variables.SO_PORTI && role == -1; i++) {
+      if(ports_infos[i].port_pid == pid) {
+         role = IPC_ROLE_PORT;
+         index = i;
+      }
+   }
+   for(i=0; i<my_config_variables.SO_NAVI && role == -1; i++) {
+      if(ship_slots[i].ship_pid == pid) {
+         role = IPC_ROLE_SHIP;
+         index = i;
+      }
+   }
+   if(role == -1 || processes_count == my_config_variables.SO_PORTI + my_config_variables.SO_NAVI) {
+      return;
+   }
+
+   fill_process_usage(&processes_usage[processes_count], usage);
+   processes_usage[processes_count].pid = pid;
+   processes_usage[processes_count].role = role;
+   processes_usage[processes_count].index = index;
+   processes_count++;
+}
+
+/*
+ * This method fills the given process usage with the given rusage
+ */
+void fill_process_usage(struct process_usage *process, struct rusage *usage) {
+   process->user = usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+   process->sys = usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+   process->voluntary = usage->ru_nvcsw;
+   process->involuntary = usage->ru_nivcsw;
+   process->max_rss = usage->ru_maxrss;
+   process->minor_faults = usage->ru_minflt;
+}
+
+/*
+ * This method sums the resources used by the processes of each role (IPC_ROLE_MASTER...) 
+ * in the given totals and counts them: the max RSS is the largest one of the role
+ */
+void rusage_totals(struct process_usage *totals, int *processes) {
+   struct process_usage *process;
+   struct rusage usage;
+   int i;
+
+   memset(totals, 0, IPC_ROLES * sizeof(struct process_usage));
+   memset(processes, 0, IPC_ROLES * sizeof(int));
+   getrusage(RUSAGE_SELF, &usage);
+   fill_process_usage(&totals[IPC_ROLE_MASTER], &usage);
+   processes[IPC_ROLE_MASTER] = 1;
+
+   for(i=0; i<processes_count; i++) {
+      process = &processes_usage[i];
+      totals[process->role].user += process->user;
+      totals[process->role].sys += process->sys;
+      totals[process->role].voluntary += process->voluntary;
+      totals[process->role].involuntary += process->involuntary;
+      totals[process->role].minor_faults += process->minor_faults;
+      if(process->max_rss > totals[process->role].max_rss) {
+         totals[process->role].max_rss = process->max_rss;
+      }
+      processes[process->role]++;
+   }
+}
+
+/*
+ * This method compares two process usages by the CPU time (user and system) they used, descending
+ */
+int compare_processes_by_cpu(const void *a, const void *b) {
+   double cpu_a = ((struct process_usage *)a)->user + ((struct process_usage *)a)->sys;
+   double cpu_b = ((struct process_usage *)b)->user + ((struct process_usage *)b)->sys;
+
+   return (cpu_a < cpu_b) - (cpu_a > cpu_b);
+}
+
+/*
+ * This method prints the resources used by the processes of each role and the RUSAGE_TOP 
+ * processes that used the most CPU
+ */
+void print_rusage_stats() {
+   const char *roles[IPC_ROLES] = {"Master", "Ports", "Ships"};
+   const char *names[IPC_ROLES] = {"Master", "Port", "Ship"};
+   struct process_usage totals[IPC_ROLES], *process;
+   int processes[IPC_ROLES];
+   int i;
+
+   rusage_totals(totals, processes);
+   qsort(processes_usage, processes_count, sizeof(struct process_usage), compare_processes_by_cpu);
+
+   printf("\n\nRESOURCE USAGE STATS");
+   for(i=0; i<IPC_ROLES; i++) {
+      printf("\n\t%s (%d processes): user: %.3f s, sys: %.3f s, context switches: %ld voluntary, %ld involuntary, max RSS: %ld KB, minor faults: %ld", 
+         roles[i], processes[i], totals[i].user, totals[i].sys, totals[i].voluntary, totals[i].involuntary, 
+         totals[i].max_rss, totals[i].minor_faults);
+   }
+   printf("\n\tThe processes that used the most CPU:");
+   for(i=0; i<processes_count && i<RUSAGE_TOP; i++) {
+      process = &processes_usage[i];
+      printf("\n\t\t%s %d (pid %d): user: %.3f s, sys: %.3f s, context switches: %ld voluntary, %ld involuntary", 
+         names[process->role], process->index, process->pid, process->user, process->sys, 
+         process->voluntary, process->involuntary);
+   }
+   printf("\n------------\n");
+}
+
+/*
+ * This method exports the resources used by the processes of each role (see print_rusage_stats)
+ */
+void export_rusage_stats() {
+   struct process_usage totals[IPC_ROLES];
+   long values[EXPORT_MAX_FIELDS];
+   int processes[IPC_ROLES];
+   int i;
+
+   rusage_totals(totals, processes);
+   for(i=0; i<IPC_ROLES; i++) {
+      values[0] = i;
+      values[1] = processes[i];
+      values[2] = totals[i].user * 1000;
+      values[3] = totals[i].sys * 1000;
+      values[4] = totals[i].voluntary;
+      values[5] = totals[i].involuntary;
+      values[6] = totals[i].max_rss;
+      values[7] = totals[i].minor_faults;
+      export_record(EXPORT_RUSAGE, current_day, values);
+   }
+
+   export_flush();
+}
+
+/*
+ * This method creates the shared header with the registry key of this directory and attaches it.
+ * If the key is taken by a run whose master is dead, its IPC objects are removed first
+ */
+int create_header() {
+   key_t key = ftok(".", IPC_REGISTRY_PROJ);
+   int id;
+
+   id = shmget(key, sizeof(struct shared_header), IPC_CREAT | IPC_EXCL | 0666);
+   if(id == -1 && errno == EEXIST && cleanup_run(key) == 0) {
+      id = shmget(key, sizeof(struct shared_header), IPC_CREAT | IPC_EXCL | 0666);
+   }
+   if(id == -1) {
+      perror("shared header creation failed!");
+      exit(EXIT_FAILURE);
+   }
+
+   shared_header = (struct shared_header *)ipc_shmat(id, NULL, 0);
+   shared_header->ports_shm_id = -1;
+   shared_header->registry.master_pid = getpid();
+   shared_header->registry.count = 0;
+   register_ipc(IPC_OBJECT_SHM, id);
+
+   return id;
+}
+
+/*
+ * This method adds the given IPC object to the registry of the shared header and returns its id.
+ * If the object couldn't be created, the ones already registered are removed
+ */
+int register_ipc(int kind, int id) {
+   if(id == -1) {
+      perror("ipc creation failed!");
+      remove_ipc_objects(shared_header);
+      exit(EXIT_FAILURE);
+   }
+
+   shared_header->registry.kinds[shared_header->registry.count] = kind;
+   shared_header->registry.ids[shared_header->registry.count] = id;
+   shared_header->registry.count++;
+
+   return id;
+}
+
+/*
+ * This method removes every IPC object of the simulation: the message queues of the ports
+ * (once, when they share a queue) and then the objects listed in the registry of the given
+ * header, the header itself last. The header stays attached until the caller detaches it
+ */
+void remove_ipc_objects(struct shared_header *header) {
+   struct port_info *ports;
+   int i, ports_count;
+
+   if(header->ports_shm_id != -1) {
+      ports = (struct port_info *)shmat(header->ports_shm_id, NULL, SHM_RDONLY);
+      if(ports != (void *)-1) {
+         ports_count = header->ports_count < header->config.SO_PORTI ? header->ports_count : header->config.SO_PORTI;
+         for(i=0; i<ports_count; i++) {
+            if(ports[i].msg_queue_id != -1 && (i == 0 || ports[i].msg_queue_id != ports[i-1].msg_queue_id)) {
+               msgctl(ports[i].msg_queue_id, IPC_RMID, NULL);
+            }
+         }
+         shmdt(ports);
+      }
+   }
+
+   for(i=header->registry.count-1; i>=0; i--) {
+      switch(header->registry.kinds[i]) {
+         case IPC_OBJECT_SHM:
+            shmctl(header->registry.ids[i], IPC_RMID, NULL);
+            break;
+         case IPC_OBJECT_SEM:
+            semctl(header->registry.ids[i], 0, IPC_RMID);
+            break;
+         case IPC_OBJECT_MSG:
+            msgctl(header->registry.ids[i], IPC_RMID, NULL);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+/*
+ * This method removes the IPC objects of the run registered with the given key, unless its
+ * master is still alive. It returns 0 if there was nothing left or everything was removed
+ */
+int cleanup_run(key_t key) {
+   struct shared_header *header;
+   pid_t master_pid;
+   int id;
+
+   id = shmget(key, 0, 0);
+   if(id == -1) {
+      printf("No IPC objects left by a previous run\n");
+      return 0;
+   }
+
+   header = (struct shared_header *)shmat(id, NULL, 0);
+   if(header == (void *)-1) {
+      perror("shared header attach failed!");
+      return -1;
+   }
+
+   master_pid = header->registry.master_pid;
+   if(master_pid > 0 && master_pid != getpid() && kill(master_pid, 0) == 0) {
+      printf("The simulation of master %d is still running\n", master_pid);
+      shmdt(header);
+      return -1;
+   }
+
+   remove_ipc_objects(header);
+   shmdt(header);
+   shmctl(id, IPC_RMID, NULL);
+   printf("Removed the IPC objects left by master %d\n", master_pid);
+
+   return 0;
+}
+
+/*
+ * This method prepares the tracing of the events: the trace rings of the ports and of the ships
+ * in shared memory, the header of the trace file and the timer that drains the rings
+ */
+void setup_tracing() {
+   struct itimerspec drain;
+   struct epoll_event event;
+   unsigned int version = 1;
+   int rings = my_config_variables.SO_PORTI + my_config_variables.SO_NAVI;
+
+   trace_shm_id = register_ipc(IPC_OBJECT_SHM, 
+      shmget(IPC_PRIVATE, rings * sizeof(struct trace_ring), IPC_CREAT | 0666));
+   trace_rings = (struct trace_ring *)ipc_shmat(trace_shm_id, NULL, 0);
+   shared_header->trace_shm_id = trace_shm_id;
+
+   trace_buffer = malloc(EXPORT_BUFFER_SIZE);
+   setvbuf(trace_file, trace_buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+   fwrite("SOTR", 1, 4, trace_file);
+   fwrite(&version, sizeof(version), 1, trace_file);
+   fwrite(&my_config_variables.SO_PORTI, sizeof(int), 1, trace_file);
+   fwrite(&my_config_variables.SO_NAVI, sizeof(int), 1, trace_file);
+
+   trace_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+   drain.it_value.tv_sec = 0;
+   drain.it_value.tv_nsec = TRACE_DRAIN_INTERVAL * 1000000L;
+   drain.it_interval = drain.it_value;
+   timerfd_settime(trace_timer_fd, 0, &drain, NULL);
+
+   event.events = EPOLLIN;
+   event.data.fd = EVENT_TRACE_TIMER;
+   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, trace_timer_fd, &event);
+}
+
+/*
+ * This method moves the events published in the trace rings to the trace file, 
+ * then frees their place in the rings
+ */
+void drain_traces() {
+   struct trace_file_record record;
+   unsigned long head, tail;
+   int i;
+
+   for(i=0; i<my_config_variables.SO_PORTI + my_config_variables.SO_NAVI; i++) {
+      head = __atomic_load_n(&trace_rings[i].head, __ATOMIC_ACQUIRE);
+      record.ring = i;
+      for(tail = trace_rings[i].tail; tail != head; tail++) {
+         record.event = trace_rings[i].events[tail & (TRACE_RING_SIZE - 1)];
+         fwrite(&record, sizeof(record), 1, trace_file);
+         traced_events++;
+      }
+      __atomic_store_n(&trace_rings[i].tail, head, __ATOMIC_RELEASE);
+   }
+}
+
+/*
+ * This method returns the number of events lost because a trace ring was full
+ */
+unsigned long lost_traces() {
+   unsigned long lost = 0;
+   int i;
+
+   for(i=0; i<my_config_variables.SO_PORTI + my_config_variables.SO_NAVI; i++) {
+      lost += trace_rings[i].dropped;
+   }
+
+   return lost;
+}
+
+/*
+ * This method sends the given signal to every port and ship. In zygote mode the pids of the
+ * forked processes are known only once they completed their setup, the others are skipped
+ */
+void signal_to_everyone(int signal) {
+   int i;
+
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      if(ports_pids[i] > 0) {
+         kill(ports_pids[i], signal);
+      }
+   }
+   for(i=0; i<my_config_variables.SO_NAVI; i++) {
+      if(ships_pids[i] > 0) {
+         kill(ships_pids[i], signal);
+      }
+   }
+}
+
+void free_existing_data_structures() {
+   int i;
+
+   printf("\n\nMaster about to free the memory...\n");
+
+   /* Mallocs free */
+   free(ports_pids);
+   free(ships_pids);
+   free(ports_snapshot);
+   free(products_snapshot);
+   free(waiting_sum);
+   free(occupied_sum);
+   free(waiting_max);
+   free(lanes);
+   if(export_enabled()) {
+      export_close();
+   }
+
+   for(i=0; i<PORT_PARAMS_COUNT-1; i++) {
+      free(port_params[i]);
+   }
+   free(port_params);
+
+   for(i=0; i<SHIP_PARAMS_COUNT-1; i++) {
+      free(ship_params[i]);
+   }
+   free(ship_params);
+   
+   /* 
+    * Ipcs free: every object is removed from the registry in the shared header, the
+    * segments are detached by the exit
+    */
+   remove_ipc_objects(shared_header);
+   ipc_shmdt(shared_header);
+
+   printf("Free completed successfully\n");
+}
+
+/*
+ * This method reports the stats of the current day, taken from a consistent copy: they are 
+ * written to the export file and printed as chosen with --report. At the end of the simulation 
+ * the top ports of each product and the timings of the simulation are reported too
+ */
+void print_stats() {
+   take_stats_snapshot();
+
+   if(export_enabled()) {
+      export_stats();
+   }
+
+   if(report_mode == REPORT_FULL) {
+      print_full_report();
+   } else if(report_mode == REPORT_SUMMARY) {
+      print_summary();
+   } else {
+      return;
+   }
+
+   /* Startup stats */
+   if(ended && first_tick.tv_sec != 0) {
+      printf("\n\nSTARTUP STATS (%s)", my_config_variables.SO_ZYGOTE ? "zygote" : "fork and exec");
+      printf("\n\tSeed: %lu (--seed %lu builds the same world)", my_config_variables.SO_SEED, my_config_variables.SO_SEED);
+      printf("\n\tFrom the first fork to the simulation start: %.3f s", 
+         (shared_header->sim_start.tv_sec - spawn_start.tv_sec) + (shared_header->sim_start.tv_nsec - spawn_start.tv_nsec) / 1e9);
+      printf("\n\tTime to first tick: %.3f s", 
+         (first_tick.tv_sec - spawn_start.tv_sec) + (first_tick.tv_nsec - spawn_start.tv_nsec) / 1e9);
+      printf("\n------------\n");
+   }
+
+   /* Day clock stats */
+   if(ended && ticks > 0) {
+      printf("\n\nDAY CLOCK STATS");
+      printf("\n\tDays handled: %d", ticks);
+      printf("\n\tJitter from the deadlines, mean: %.3f ms, max: %.3f ms", 
+         tick_jitter_sum / ticks * 1e3, tick_jitter_max * 1e3);
+      printf("\n\tDays whose stats were copied during an update: %d", torn_snapshots);
+      printf("\n------------\n");
+   }
+}
+
+void print_full_report() {
+   int i;
+
+   printf("\n\t\t\t\tSTATS ON DAY %d%s", current_day, snapshot_torn ? " (copied during an update)" : "");
+
+   /* Ship stats */
+   printf("\n\nSHIPS STATS ON DAY %d", current_day);
+   printf("\n\tEmpty: %d", ships_snapshot[0]);
+   printf("\n\tLoaded: %d", ships_snapshot[1]);
+   printf("\n\tIn port: %d", ships_snapshot[2]);
+   printf("\n------------\n");
+
+   /* Ports stats */
+   printf("\n\nPORTS STATS ON DAY %d", current_day);
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      printf("\nPort %d, quays occupied: %d / %d", ports_infos[i].port_pid, 
+         ports_snapshot[i].occupied_quays, ports_snapshot[i].total_quays);
+      printf("\n\tShips inbound: %d, waiting for a quay: %d", quays_queues[i].inbound, quays_queues[i].waiting);
+      printf("\n\tTons available: %ld", ports_snapshot[i].tons_available);
+      printf("\n\tTons shipped: %ld", ports_snapshot[i].tons_shipped);
+      printf("\n\tTons delivered: %ld", ports_snapshot[i].tons_delivered);
+      printf("\n\tTons expired: %ld\n", ports_snapshot[i].tons_expired);
+   }
+   printf("\n------------\n");
+
+   /* Products stats */
+   printf("\n\nPRODUCTS STATS ON DAY %d", current_day);
+   for(i=0; i<my_config_variables.SO_MERCI; i++) {
+      printf("\nProduct %d", i);
+      printf("\n\tGenerated: %ld", products_snapshot[i].generated);
+      printf("\n\tAvailable in ports: %ld, Expired in ports: %ld", products_snapshot[i].available_port, products_snapshot[i].expired_port);
+      printf("\n\tOn ship: %ld, Expired on a ship: %ld", products_snapshot[i].on_ship, products_snapshot[i].expired_ship);
+      printf("\n\tDelivered: %ld", products_snapshot[i].delivered);
+      if(ended) {
+         printf("\n\tTop offering port: %d, Top demanding port: %d", 
+            products_snapshot[i].top_offering_port, products_snapshot[i].top_demanding_port);
+      }
+   }
+   printf("\n------------\n");
+}
+
+/*
+ * This method prints the totals of the current day on a single line
+ */
+void print_summary() {
+   long generated = 0, available = 0, on_ship = 0, delivered = 0, expired = 0;
+   int i;
+
+   for(i=0; i<my_config_variables.SO_MERCI; i++) {
+      generated += products_snapshot[i].generated;
+      available += products_snapshot[i].available_port;
+      on_ship += products_snapshot[i].on_ship;
+      delivered += products_snapshot[i].delivered;
+      expired += products_snapshot[i].expired_port + products_snapshot[i].expired_ship;
+   }
+
+   printf("\nDay %d: ships empty %d, loaded %d, in port %d; tons generated %ld, available %ld, "
+      "on ships %ld, delivered %ld, expired %ld%s\n", current_day, ships_snapshot[0], ships_snapshot[1], 
+      ships_snapshot[2], generated, available, on_ship, delivered, expired, 
+      snapshot_torn ? " (copied during an update)" : "");
+}
+
+/*
+ * This method writes the stats of the current day to the export file (see export.h), 
+ * at the end of the simulation followed by the top ports of each product
+ */
+void export_stats() {
+   long values[EXPORT_MAX_FIELDS];
+   int i;
+
+   values[0] = ships_snapshot[0];
+   values[1] = ships_snapshot[1];
+   values[2] = ships_snapshot[2];
+   export_record(EXPORT_SHIPS, current_day, values);
+
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      values[0] = i;
+      values[1] = ports_infos[i].port_pid;
+      values[2] = ports_snapshot[i].occupied_quays;
+      values[3] = ports_snapshot[i].total_quays;
+      values[4] = quays_queues[i].inbound;
+      values[5] = quays_queues[i].waiting;
+      values[6] = ports_snapshot[i].tons_available;
+      values[7] = ports_snapshot[i].tons_shipped;
+      values[8] = ports_snapshot[i].tons_delivered;
+      values[9] = ports_snapshot[i].tons_expired;
+      export_record(EXPORT_PORT, current_day, values);
+   }
+
+   for(i=0; i<my_config_variables.SO_MERCI; i++) {
+      values[0] = i;
+      values[1] = products_snapshot[i].generated;
+      values[2] = products_snapshot[i].available_port;
+      values[3] = products_snapshot[i].expired_port;
+      values[4] = products_snapshot[i].on_ship;
+      values[5] = products_snapshot[i].expired_ship;
+      values[6] = products_snapshot[i].delivered;
+      export_record(EXPORT_PRODUCT, current_day, values);
+   }
+
+   if(ended) {
+      for(i=0; i<my_config_variables.SO_MERCI; i++) {
+         values[0] = i;
+         values[1] = products_snapshot[i].top_offering_port;
+         values[2] = products_snapshot[i].top_demanding_port;
+         export_record(EXPORT_TOP_PORTS, current_day, values);
+      }
+   }
+
+   export_flush();
+}
+
+/*
+ * This method returns the given value of the usage of a ship, in the order of struct ship_usage
+ */
+double ship_usage_value(struct ship_usage *usage, int value) {
+   switch(value) {
+      case 0:
+         return usage->sailing_loaded;
+      case 1:
+         return usage->sailing_empty;
+      case 2:
+         return usage->waiting;
+      case 3:
+         return usage->exchanging;
+      case 4:
+         return usage->ton_distance;
+      case 5:
+         return usage->delivered;
+      case 6:
+         return usage->expired;
+      default:
+         return usage->failed_reservations;
+   }
+}
+
+/*
+ * This method compares two doubles, it is used to order the usages of the ships
+ */
+int compare_doubles(const void *a, const void *b) {
+   double x = *(const double *)a, y = *(const double *)b;
+
+   return (x > y) - (x < y);
+}
+
+/*
+ * This method prints the distribution over the fleet of each value of the usage of the ships
+ * (see struct ship_usage): the minimum, the median, the maximum and the total
+ */
+void print_ship_usage() {
+   const char *names[] = {"Sailing loaded (days)", "Sailing empty (days)", "Waiting for a quay (days)",
+      "Loading and unloading (days)", "Tons x distance", "Tons delivered", "Tons expired on board",
+      "Failed reservations"};
+   int i, j, ships = my_config_variables.SO_NAVI;
+   double *values, total;
+
+   values = malloc(ships * sizeof(double));
+   printf("\n\nSHIPS USAGE (min / median / max of the %d ships, total)", ships);
+   for(i=0; i<(int)(sizeof(names) / sizeof(names[0])); i++) {
+      total = 0;
+      for(j=0; j<ships; j++) {
+         values[j] = ship_usage_value(&ships_usage[j], i);
+         total += values[j];
+      }
+      qsort(values, ships, sizeof(double), compare_doubles);
+      printf("\n\t%s: %.2f / %.2f / %.2f, %.2f", names[i], values[0], 
+         (values[(ships - 1) / 2] + values[ships / 2]) / 2, values[ships - 1], total);
+   }
+   printf("\n------------\n");
+   free(values);
+}
+
+/*
+ * This method exports the usage of each ship, with the times in milliseconds
+ */
+void export_ship_usage() {
+   long values[EXPORT_MAX_FIELDS];
+   int i;
+
+   for(i=0; i<my_config_variables.SO_NAVI; i++) {
+      values[0] = i;
+      values[1] = (long)(ships_usage[i].sailing_loaded * 1e3);
+      values[2] = (long)(ships_usage[i].sailing_empty * 1e3);
+      values[3] = (long)(ships_usage[i].waiting * 1e3);
+      values[4] = (long)(ships_usage[i].exchanging * 1e3);
+      values[5] = (long)ships_usage[i].ton_distance;
+      values[6] = ships_usage[i].delivered;
+      values[7] = ships_usage[i].expired;
+      values[8] = ships_usage[i].failed_reservations;
+      export_record(EXPORT_SHIP_USAGE, current_day, values);
+   }
+
+   export_flush();
+}
+
+/*
+ * These methods compare two lanes by origin and destination port, and by tons (more tons first)
+ */
+int compare_lanes_by_port(const void *a, const void *b) {
+   const struct lane *x = a, *y = b;
+
+   if(x->origin != y->origin) {
+      return x->origin - y->origin;
+   }
+   return x->destination - y->destination;
+}
+
+int compare_lanes_by_tons(const void *a, const void *b) {
+   const struct lane *x = a, *y = b;
+
+   return (x->tons < y->tons) - (x->tons > y->tons);
+}
+
+/*
+ * This method merges the lanes added to the pool by the ship processes: the same lane can be 
+ * in the pool many times, once for each process (and for each time its table was added)
+ */
+void merge_lanes() {
+   int i, count = shared_header->lanes_count;
+
+   if(count > shared_header->lanes_size) {
+      count = shared_header->lanes_size;
+   }
+   lanes = malloc((count > 0 ? count : 1) * sizeof(struct lane));
+   memcpy(lanes, lanes_pool, count * sizeof(struct lane));
+   qsort(lanes, count, sizeof(struct lane), compare_lanes_by_port);
+
+   for(i=0; i<count; i++) {
+      if(lanes_count > 0 && compare_lanes_by_port(&lanes[lanes_count - 1], &lanes[i]) == 0) {
+         lanes[lanes_count - 1].tons += lanes[i].tons;
+         lanes[lanes_count - 1].voyages += lanes[i].voyages;
+         lanes[lanes_count - 1].transit += lanes[i].transit;
+      } else {
+         lanes[lanes_count++] = lanes[i];
+      }
+   }
+   qsort(lanes, lanes_count, sizeof(struct lane), compare_lanes_by_tons);
+}
+
+/*
+ * This method prints the LANE_TOP lanes that carried the most tons
+ */
+void print_lanes() {
+   long total = 0, top = 0;
+   int i;
+
+   for(i=0; i<lanes_count; i++) {
+      total += lanes[i].tons;
+      if(i < LANE_TOP) {
+         top += lanes[i].tons;
+      }
+   }
+
+   printf("\n\nLANES STATS (%d lanes of %d used, %ld tons delivered, the top %d carried %.1f%%)", 
+      lanes_count, my_config_variables.SO_PORTI * (my_config_variables.SO_PORTI - 1), total, LANE_TOP, 
+      total > 0 ? 100.0 * top / total : 0.0);
+   for(i=0; i<lanes_count && i<LANE_TOP; i++) {
+      printf("\n\tPort %d -> Port %d: %ld tons, %ld voyages, mean transit: %.2f days", lanes[i].origin, 
+         lanes[i].destination, lanes[i].tons, lanes[i].voyages, lanes[i].transit / lanes[i].voyages);
+   }
+   if(shared_header->lanes_lost > 0) {
+      printf("\n\tTons of the lanes that didn't fit in the pool: %ld", shared_header->lanes_lost);
+   }
+   printf("\n------------\n");
+}
+
+/*
+ * This method exports the LANE_TOP lanes that carried the most tons, with the mean transit in milliseconds
+ */
+void export_lanes() {
+   long values[EXPORT_MAX_FIELDS];
+   int i;
+
+   for(i=0; i<lanes_count && i<LANE_TOP; i++) {
+      values[0] = i + 1;
+      values[1] = lanes[i].origin;
+      values[2] = lanes[i].destination;
+      values[3] = lanes[i].tons;
+      values[4] = lanes[i].voyages;
+      values[5] = (long)(lanes[i].transit / lanes[i].voyages * 1e3);
+      export_record(EXPORT_LANES, current_day, values);
+   }
+
+   export_flush();
+}
+
+/*
+ * This method prints the delays of the sleeps from their requested wake-up (see struct sleep_skew)
+ * and the deadlines missed because of them: when they are many, the results are limited
+ * by the host rather than by the model
+ */
+void print_skew_stats() {
+   const char *kinds[SKEW_KINDS] = {"Navigations", "Exchanges", "Days"};
+   struct sleep_skew *skew;
+   int i;
+
+   printf("\n\nSLEEP SKEW STATS (timer slack: %d ns, the percentiles are within 1/%d)", 
+      prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0), HDR_SUB_BUCKETS);
+   for(i=0; i<SKEW_KINDS; i++) {
+      skew = &shared_header->skew[i];
+      printf("\n\t%s: %lu sleeps, late p50: %.3f ms, p99: %.3f ms, max: %.3f ms, deadlines missed: %lu", 
+         kinds[i], skew->sleeps, hdr_percentile(skew->histogram, skew->max, 0.5) / 1e3, 
+         hdr_percentile(skew->histogram, skew->max, 0.99) / 1e3, skew->max / 1e3, skew->missed);
+   }
+   printf("\n------------\n");
+}
+
+/*
+ * This method exports the delays of the sleeps of each kind, in microseconds
+ */
+void export_skew_stats() {
+   struct sleep_skew *skew;
+   long values[EXPORT_MAX_FIELDS];
+   int i;
+
+   for(i=0; i<SKEW_KINDS; i++) {
+      skew = &shared_header->skew[i];
+      values[0] = i;
+      values[1] = skew->sleeps;
+      values[2] = skew->missed;
+      values[3] = hdr_percentile(skew->histogram, skew->max, 0.5);
+      values[4] = hdr_percentile(skew->histogram, skew->max, 0.99);
+      values[5] = skew->max;
+      export_record(EXPORT_SKEW, current_day, values);
+   }
+
+   export_flush();
+}
+
+/*
+ * This method samples the ships waiting for a quay and the occupied quays of each port,
+ * exported as a time series (see EXPORT_QUAYS)
+ */
+void sample_quays() {
+   struct timespec now;
+   long values[EXPORT_MAX_FIELDS];
+   int i, waiting;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   quay_samples++;
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      waiting = quays_queues[i].waiting;
+      waiting_sum[i] += waiting;
+      occupied_sum[i] += all_ports_stats[i].occupied_quays;
+      if(waiting > waiting_max[i]) {
+         waiting_max[i] = waiting;
+      }
+      if(export_enabled()) {
+         values[0] = i;
+         values[1] = (now.tv_sec - shared_header->sim_start.tv_sec) * 1000L + 
+            (now.tv_nsec - shared_header->sim_start.tv_nsec) / 1000000L;
+         values[2] = waiting;
+         values[3] = quays_queues[i].inbound;
+         values[4] = all_ports_stats[i].occupied_quays;
+         export_record(EXPORT_QUAYS, current_day, values);
+      }
+   }
+}
+
+/*
+ * This method prints, for each port, the times the ships waited for a quay and held it 
+ * (in days, see struct quay_stats) and the samples of its queue
+ */
+void print_quay_stats() {
+   struct quay_stats *stats;
+   int i;
+
+   printf("\n\nQUAYS STATS (times in days, the percentiles are within 1/%d)", HDR_SUB_BUCKETS);
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      stats = &quay_stats[i];
+      printf("\n\tPort %d (%d quays): %lu docks", i, all_ports_stats[i].total_quays, stats->docks);
+      printf("\n\t\tWait for a quay, p50: %.6f, p99: %.6f, max: %.6f", hdr_percentile(stats->wait, stats->wait_max, 0.5) / 1e6,
+         hdr_percentile(stats->wait, stats->wait_max, 0.99) / 1e6, stats->wait_max / 1e6);
+      printf("\n\t\tQuay held, p50: %.6f, p99: %.6f, max: %.6f", hdr_percentile(stats->hold, stats->hold_max, 0.5) / 1e6,
+         hdr_percentile(stats->hold, stats->hold_max, 0.99) / 1e6, stats->hold_max / 1e6);
+      if(quay_samples > 0) {
+         printf("\n\t\tShips waiting, mean: %.2f, max: %d; occupied quays, mean: %.2f", 
+            (double)waiting_sum[i] / quay_samples, waiting_max[i], (double)occupied_sum[i] / quay_samples);
+      }
+   }
+   printf("\n------------\n");
+}
+
+/*
+ * This method exports the times of the quays of each port, in microseconds (see print_quay_stats)
+ */
+void export_quay_stats() {
+   struct quay_stats *stats;
+   long values[EXPORT_MAX_FIELDS];
+   int i;
+
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      stats = &quay_stats[i];
+      values[0] = i;
+      values[1] = stats->docks;
+      values[2] = hdr_percentile(stats->wait, stats->wait_max, 0.5);
+      values[3] = hdr_percentile(stats->wait, stats->wait_max, 0.99);
+      values[4] = stats->wait_max;
+      values[5] = hdr_percentile(stats->hold, stats->hold_max, 0.5);
+      values[6] = hdr_percentile(stats->hold, stats->hold_max, 0.99);
+      values[7] = stats->hold_max;
+      export_record(EXPORT_QUAY_TIMES, current_day, values);
+   }
+
+   export_flush();
+}
+
+/*
+ * This method returns the upper bound (in ns) of the bucket of the histogram of the given call
+ * that contains the given fraction of the calls
+ */
+unsigned long ipc_percentile(struct ipc_call_stats *stats, double fraction) {
+   unsigned long count = 0;
+   int i;
+
+   for(i=0; i<IPC_HISTOGRAM_BUCKETS - 1; i++) {
+      count += stats->histogram[i];
+      if(count >= fraction * stats->calls) {
+         break;
+      }
+   }
+
+   return 2UL << i;
+}
+
+/*
+ * This method prints the IPC calls of each role, added by the processes when they ended: 
+ * the calls, the latencies and their histogram, with the bucket b as log2 of the ns
+ */
+void print_ipc_stats() {
+   const char *roles[IPC_ROLES] = {"Master", "Ports", "Ships"};
+   const char *calls[IPC_CALLS] = {"semop", "semctl", "msgsnd", "msgrcv", "shmat", "shmdt"};
+   struct ipc_call_stats *stats;
+   unsigned long total_calls, total_ns;
+   int i, j, k;
+
+   printf("\n\nIPC STATS (the latency includes the time spent blocked)");
+   for(i=0; i<IPC_ROLES; i++) {
+      total_calls = 0;
+      total_ns = 0;
+      for(j=0; j<IPC_CALLS; j++) {
+         total_calls += shared_header->ipc_stats[i][j].calls;
+         total_ns += shared_header->ipc_stats[i][j].total_ns;
+      }
+      printf("\n\t%s: %lu calls, %.3f s", roles[i], total_calls, total_ns / 1e9);
+
+      for(j=0; j<IPC_CALLS; j++) {
+         stats = &shared_header->ipc_stats[i][j];
+         if(stats->calls == 0) {
+            continue;
+         }
+         printf("\n\t\t%s: %lu calls, %lu failed, mean: %.1f us, p50: < %.1f us, p99: < %.1f us, max: %.1f us",
+            calls[j], stats->calls, stats->failed, stats->total_ns / 1e3 / stats->calls,
+            ipc_percentile(stats, 0.5) / 1e3, ipc_percentile(stats, 0.99) / 1e3, stats->max_ns / 1e3);
+         printf("\n\t\t\thistogram (b:calls)");
+         for(k=0; k<IPC_HISTOGRAM_BUCKETS; k++) {
+            if(stats->histogram[k] > 0) {
+               printf(" %d:%lu", k, stats->histogram[k]);
+            }
+         }
+      }
+   }
+   printf("\n------------\n");
+}
+
+/*
+ * This method exports the IPC calls of each role (see print_ipc_stats) 
+ */
+void export_ipc_stats() {
+   struct ipc_call_stats *stats;
+   long values[EXPORT_MAX_FIELDS];
+   int i, j;
+
+   for(i=0; i<IPC_ROLES; i++) {
+      for(j=0; j<IPC_CALLS; j++) {
+         stats = &shared_header->ipc_stats[i][j];
+         if(stats->calls == 0) {
+            continue;
+         }
+         values[0] = i;
+         values[1] = j;
+         values[2] = stats->calls;
+         values[3] = stats->failed;
+         values[4] = stats->total_ns;
+         values[5] = stats->max_ns;
+         values[6] = ipc_percentile(stats, 0.5);
+         values[7] = ipc_percentile(stats, 0.99);
+         export_record(EXPORT_IPC, current_day, values);
+      }
+   }
+
+   export_flush();
+}
+
+/*
+ * This method copies the stats when no group of updates is in progress (see struct shared_header):
+ * the counter of the ended groups is read before the one of the started groups, if they are equal
+ * no group was in progress, and if no group started during the copy the copy is consistent.
+ * Otherwise the copy is taken again, letting the writers run in the meantime. A process that dies
+ * inside a group, or writers that never pause, would stall the day: after SNAPSHOT_MAX_RETRIES 
+ * tries the copy is taken anyway and flagged as torn
+ */
+void take_stats_snapshot() {
+   unsigned long begin, end;
+   int retries;
+
+   for(retries=0; retries<SNAPSHOT_MAX_RETRIES; retries++) {
+      end = shared_header->stats_end;
+      __sync_synchronize();
+      begin = shared_header->stats_begin;
+
+      if(begin == end) {
+         copy_stats();
+         __sync_synchronize();
+         if(shared_header->stats_begin == begin) {
+            snapshot_torn = 0;
+            return;
+         }
+      }
+      sched_yield();
+   }
+
+   copy_stats();
+   snapshot_torn = 1;
+   torn_snapshots++;
+}
+
+/*
+ * This method copies the stats in shared memory to the snapshot
+ */
+void copy_stats() {
+   memcpy(ships_snapshot, all_ships_stats, 3 * sizeof(int));
+   memcpy(ports_snapshot, all_ports_stats, my_config_variables.SO_PORTI * sizeof(struct port_stats));
+   memcpy(products_snapshot, all_products_stats, my_config_variables.SO_MERCI * sizeof(struct prod_stats));
+}
+
+/*
+ * This method fills the index of the products once every port completed its setup: for each
+ * product, the list of the elements of the catalogues that contain the product. The lists are
+ * built visiting the catalogues in order, so each list is ordered by port
+ */
+void build_product_index() {
+   int i, j, *offsets, *elements;
+
+   offsets = product_index;
+   elements = product_index + my_config_variables.SO_MERCI + 1;
+
+   bzero(offsets, (my_config_variables.SO_MERCI + 1) * sizeof(int));
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      for(j=i*catalogue_stride; j<i*catalogue_stride + ports_infos[i].products_count; j++) {
+         offsets[catalogue[j].product_id + 1]++;
+      }
+   }
+   for(i=0; i<my_config_variables.SO_MERCI; i++) {
+      offsets[i + 1] += offsets[i];
+   }
+
+   /* The offsets are used as insertion points, then restored */
+   for(i=0; i<my_config_variables.SO_PORTI; i++) {
+      for(j=i*catalogue_stride; j<i*catalogue_stride + ports_infos[i].products_count; j++) {
+         elements[offsets[catalogue[j].product_id]++] = j;
+      }
+   }
+   for(i=my_config_variables.SO_MERCI; i>0; i--) {
+      offsets[i] = offsets[i - 1];
+   }
+   offsets[0] = 0;
+}
+
+/* 
+ * This method is used to find, for each product, the port that offered the most tons and
  * the port that demanded the most tons
  */
 void find_best_ports() {
-   int i, j, max_offer = 0, max_demand = 0;
+   int i, j, element;
+   long max_offer = 0, max_demand = 0;
    pid_t top_offering_port = 0, top_demanding_port = 0;
 
    for(i=0; i<my_config_variables.SO_MERCI; i++) {
-      for(j=0; j<my_config_variables.SO_PORTI; j++) {
-         ports_infos[j].my_products_offer = (struct product *)shmat(ports_infos[j].off_shm_id, NULL, 0);
-         all_products_stats[i].available_port += ports_infos[j].my_products_offer[i].ton;
-         if(ports_infos[j].my_products_offer[i].ton > max_offer) {
-            max_offer = ports_infos[j].my_products_offer[i].ton;
-            top_offering_port = ports_infos[j].port_pid;
-         }
-      }
-      for(j=0; j<my_config_variables.SO_PORTI; j++) {
-         ports_infos[j].my_products_demand = (struct product *)shmat(ports_infos[j].dem_shm_id, NULL, 0);
-         if(ports_infos[j].my_products_demand[i].ton > max_demand) {
-            max_demand = ports_infos[j].my_products_demand[i].ton;
-            top_demanding_port = ports_infos[j].port_pid;
+      for(j=product_index[i]; j<product_index[i + 1]; j++) {
+         element = product_index[my_config_variables.SO_MERCI + 1 + j];
+         if(catalogue[element].type == 0) {
+            all_products_stats[i].available_port += catalogue[element].ton;
+            all_products_stats[i].generated += catalogue[element].ton;
+            if(catalogue[element].ton > max_offer) {
+               max_offer = catalogue[element].ton;
+               top_offering_port = ports_infos[element / catalogue_stride].port_pid;
+            }
+         } else if(catalogue[element].ton > max_demand) {
+            max_demand = catalogue[element].ton;
+            top_demanding_port = ports_infos[element / catalogue_stride].port_pid;
          }
       }
       all_products_stats[i].top_offering_port = top_offering_port;
@@ -573,27 +2168,27 @@ void find_best_ports() {
 
 /*
  * This method is used to evaluate if it's necessary to end the simulation prematurely:
- * if no one is offering a product and there are no loaded ships the simulation will end
+ * if no one is offering a product and there are no loaded ships the simulation will end.
+ * When the ports generate new lots during the simulation the offer can come back, so
+ * the simulation is never ended prematurely
  */
 void check_global_offer() {
    int i, j, count = 0;
 
-   ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
+   if(my_config_variables.SO_GEN_PERIOD > 0) {
+      return;
+   }
 
    for(i=0; i<my_config_variables.SO_PORTI && count == 0; i++) {
-      ports_infos[i].my_products_offer = (struct product *)shmat(ports_infos[i].off_shm_id, NULL, 0);
-      for(j=0; j<my_config_variables.SO_MERCI && count == 0; j++) {
-         if(ports_infos[i].my_products_offer[j].ton > 0) {
+      for(j=i*catalogue_stride; j<i*catalogue_stride + ports_infos[i].products_count && count == 0; j++) {
+         if(catalogue[j].type == 0 && catalogue[j].ton > 0) {
             count++;
          }
       }
    }
 
-   all_ships_stats = (int *)shmat(ship_stats_shm_id, NULL, 0);
-
    if(count == 0 && all_ships_stats[1] == 0) {
       printf("\n\n\t\t\t\tSIMULATION ABOUT TO END DUE TO LACK OF OFFER \n\n\n\n");
       ended = 1;
-      raise(SIGALRM);
    }
 }
@@ -0,0 +1,480 @@
+#include "utils.h"
+
+/*
+ * Microbenchmarks of the hot paths of the ships, linked with the methods of ship.c (built with
+ * MICROBENCH, without its main). Each of them runs on a fixture that replaces the simulation:
+ * SO_PORTI ports with random coordinates, quays and bookings, trading all the SO_MERCI products,
+ * offered or demanded at random. The shared memory of the fixture is removed as soon as it's
+ * attached, so nothing is left behind when the microbenchmarks end or crash.
+ *    - ports_sort: ports_merge_sort of the ports in a random order by their cost
+ *    - products_sort: port_offers and products_merge_sort of the offer of a port
+ *    - plan_trip: the choice of the trip of an empty ship (see navigate), the reserved tons
+ *      are given back after each choice
+ *    - reserve: reserve_product and give_reservable of the products offered by a port,
+ *      from SO_NAVI processes at the same time
+ *    - round_trip: load_unload_product of a ton with a port process (see microbench_port.c)
+ *      serving it with handle_swap, then the ton is removed from the hold. The ship loads 
+ *      MICRO_ENDLESS_TONS tons a second, so the exchange sleeps 1 ns
+ */
+
+/* Parameters of the fixture that are not set by the options */
+#define MICRO_SIZE 1000
+#define MICRO_MIN_VITA 10
+#define MICRO_MAX_VITA 30
+#define MICRO_LATO 1000
+#define MICRO_SPEED 100
+#define MICRO_CAPACITY 1000
+#define MICRO_LOADSPEED 200
+#define MICRO_BANCHINE 4
+
+/* Tons reserved by each reserve_product of the reserve microbenchmark */
+#define MICRO_RESERVE_TONS 10
+
+/* The tons of the product exchanged by round_trip: it never runs out */
+#define MICRO_ENDLESS_TONS 1000000000000L
+
+/* Number of positions of the ship used in turn by plan_trip */
+#define MICRO_POSITIONS 64
+
+#define MICRO_BENCHES 5
+
+/* The globals of the ship (see ship.c) set by the fixture */
+extern struct ship_info my_infos;
+extern struct port_info *ports_infos;
+extern struct product *catalogue;
+extern int catalogue_stride;
+extern struct product *current_cargo;
+extern int *sorted_ports;
+extern float *ports_cost;
+extern int so_porti, so_capacity, so_merci, so_banchine;
+extern int port_dest_index, my_index;
+extern long current_capacity;
+extern float so_speed, so_lato, so_loadspeed;
+extern struct port_stats *all_ports_stats;
+extern struct prod_stats *all_products_stats;
+extern struct shared_header *shared_header;
+extern struct ship_usage *ships_usage;
+extern struct lane *lanes_table, *lanes_pool;
+extern double *quays_calendar;
+extern struct quays_queue *quays_queues;
+extern int ship_mtype;
+extern int shm_id, ports_stats_shm_id, prod_stats_shm_id, header_shm_id;
+
+void ship_malloc();
+void ports_merge_sort(int, int);
+int port_offers(int);
+void products_merge_sort(int, int);
+int plan_trip(double, struct trip_plan *);
+long reserve_product(int, int);
+int load_unload_product(int, long, int);
+void remove_cargo_tons(int, long, int);
+
+/* The ships of reserve and the number of processes of reserve (see --ships) */
+int so_navi;
+
+/* The elements of the catalogue offered by the port 0, used by reserve and round_trip */
+int *offered, offered_count;
+
+/* A random order of the ports and the positions of the ship, used by ports_sort and plan_trip */
+int *shuffled_ports;
+struct ship_info positions[MICRO_POSITIONS];
+
+const char *bench_names[MICRO_BENCHES] = {"ports_sort", "products_sort", "plan_trip", "reserve", "round_trip"};
+
+void *fixture_shm(size_t, int *);
+void setup_fixture(unsigned long);
+double run_bench(int, int);
+double bench_reserve(int);
+double bench_round_trip(int);
+double elapsed_ns(struct timespec *);
+void report(int, double *, int);
+
+int main(int argc, char *argv[]) {
+   double *samples;
+   char *bench = NULL;
+   int i, j, option, runs = 10, ops = 10000;
+   unsigned long seed = 1;
+   static struct option options[] = {
+      {"ports", required_argument, NULL, 'p'},
+      {"products", required_argument, NULL, 'm'},
+      {"ships", required_argument, NULL, 'n'},
+      {"runs", required_argument, NULL, 'r'},
+      {"ops", required_argument, NULL, 'o'},
+      {"bench", required_argument, NULL, 'b'},
+      {"seed", required_argument, NULL, 's'},
+      {NULL, 0, NULL, 0}
+   };
+
+   so_porti = 20;
+   so_merci = 10;
+   so_navi = 4;
+
+   /*
+    * --ports, --products and --ships set SO_PORTI, SO_MERCI and SO_NAVI of the fixture,
+    * --runs and --ops how many times each microbenchmark is timed and the operations timed
+    * each time, --bench runs only the given microbenchmark, --seed changes the fixture
+    */
+   while((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+      switch(option) {
+         case 'p':
+            so_porti = atoi(optarg);
+            break;
+         case 'm':
+            so_merci = atoi(optarg);
+            break;
+         case 'n':
+            so_navi = atoi(optarg);
+            break;
+         case 'r':
+            runs = atoi(optarg);
+            break;
+         case 'o':
+            ops = atoi(optarg);
+            break;
+         case 'b':
+            bench = optarg;
+            break;
+         case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [--ports SO_PORTI] [--products SO_MERCI] [--ships SO_NAVI] "
+               "[--runs RUNS] [--ops OPS] [--bench NAME] [--seed SEED]\n", argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+   if(so_porti < 1 || so_merci < 2 || so_navi < 1 || runs < 2 || ops < 1) {
+      fprintf(stderr, "At least 1 port, 2 products, 1 ship, 2 runs and 1 op are needed\n");
+      return EXIT_FAILURE;
+   }
+
+   /* The exchanges of round_trip sleep 1 ns: the default timer slack would make them sleep 50 us */
+   prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+   setup_fixture(seed);
+   samples = malloc(runs * sizeof(double));
+
+   printf("SO_PORTI: %d, SO_MERCI: %d, SO_NAVI: %d, %d runs of %d ops (the first run is a warm-up)\n",
+      so_porti, so_merci, so_navi, runs, ops);
+   for(i=0; i<MICRO_BENCHES; i++) {
+      if(bench != NULL && strcmp(bench, bench_names[i]) != 0) {
+         continue;
+      }
+      run_bench(i, ops);
+      for(j=0; j<runs; j++) {
+         samples[j] = run_bench(i, ops);
+      }
+      report(i, samples, runs);
+   }
+
+   free(samples);
+   return EXIT_SUCCESS;
+}
+
+/*
+ * This method creates a shared memory segment of the given size, attaches it and marks it
+ * to be removed: it lasts until every process that attached it (or that is started with its id)
+ * detached it. Returns its address and sets "id"
+ */
+void *fixture_shm(size_t size, int *id) {
+   void *address;
+
+   if((*id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600)) == -1) {
+      perror("fixture shmget failed!");
+      exit(EXIT_FAILURE);
+   }
+   address = shmat(*id, NULL, 0);
+   shmctl(*id, IPC_RMID, NULL);
+   memset(address, 0, size);
+
+   return address;
+}
+
+/*
+ * This method builds the fixture of the microbenchmarks and sets the globals of the ship
+ */
+void setup_fixture(unsigned long seed) {
+   struct product *element;
+   struct random_state fixture_random;
+   int i, j, id;
+
+   random_seed(&fixture_random, seed, IPC_ROLE_MASTER, 0);
+   so_banchine = MICRO_BANCHINE;
+   so_lato = MICRO_LATO;
+   so_speed = MICRO_SPEED;
+   so_capacity = MICRO_CAPACITY;
+   so_loadspeed = MICRO_LOADSPEED;
+   catalogue_stride = so_merci;
+
+   shared_header = fixture_shm(sizeof(struct shared_header), &header_shm_id);
+   shared_header->config.SO_PORTI = so_porti;
+   shared_header->config.SO_MERCI = so_merci;
+   shared_header->config.SO_NAVI = so_navi;
+   shared_header->config.SO_BANCHINE = so_banchine;
+   shared_header->catalogue_stride = catalogue_stride;
+   shared_header->lots_per_port = so_merci;
+   shared_header->trace_shm_id = -1;
+   shared_header->lanes_size = LANE_TABLE_SIZE;
+   clock_gettime(CLOCK_MONOTONIC, &shared_header->sim_start);
+
+   ports_infos = fixture_shm(so_porti * sizeof(struct port_info), &shm_id);
+   all_ports_stats = fixture_shm(so_porti * sizeof(struct port_stats), &ports_stats_shm_id);
+   all_products_stats = fixture_shm(so_merci * sizeof(struct prod_stats), &prod_stats_shm_id);
+   catalogue = fixture_shm(so_porti * catalogue_stride * sizeof(struct product), &shared_header->catalogue_shm_id);
+   fixture_shm(so_porti * so_merci * sizeof(struct lot), &shared_header->lots_shm_id);
+   ships_usage = fixture_shm(so_navi * sizeof(struct ship_usage), &id);
+   quays_calendar = fixture_shm(so_porti * so_banchine * sizeof(double), &id);
+   quays_queues = fixture_shm(so_porti * sizeof(struct quays_queue), &id);
+   lanes_pool = fixture_shm(LANE_TABLE_SIZE * sizeof(struct lane), &id);
+
+   /* Ports with random quays, bookings and catalogues: the port 0 offers at least the product 0 */
+   for(i=0; i<so_porti; i++) {
+      ports_infos[i].coord_x = random_unit(&fixture_random) * so_lato;
+      ports_infos[i].coord_y = random_unit(&fixture_random) * so_lato;
+      ports_infos[i].products_count = so_merci;
+      ports_infos[i].msg_queue_id = -1;
+      all_ports_stats[i].total_quays = 1 + random_below(&fixture_random, so_banchine);
+      all_ports_stats[i].occupied_quays = random_below(&fixture_random, all_ports_stats[i].total_quays + 1);
+      quays_queues[i].head = -1;
+      quays_queues[i].waiting = random_below(&fixture_random, 3);
+      for(j=0; j<all_ports_stats[i].total_quays; j++) {
+         quays_calendar[i * so_banchine + j] = random_unit(&fixture_random) * 2;
+      }
+      for(j=0; j<so_merci; j++) {
+         element = &catalogue[i * catalogue_stride + j];
+         element->product_id = j;
+         element->type = (i == 0 && j == 0) ? 0 : random_below(&fixture_random, 2);
+         element->ton = 1 + random_below(&fixture_random, MICRO_SIZE);
+         element->reservable = element->ton;
+         element->product_life = MICRO_MIN_VITA + random_below(&fixture_random, MICRO_MAX_VITA - MICRO_MIN_VITA + 1);
+         element->status = 1;
+         element->first_lot = -1;
+      }
+   }
+
+   offered = malloc(so_merci * sizeof(int));
+   offered_count = 0;
+   for(j=0; j<so_merci; j++) {
+      if(catalogue[j].type == 0) {
+         offered[offered_count++] = j;
+      }
+   }
+   catalogue[0].ton = MICRO_ENDLESS_TONS;
+   catalogue[0].reservable = MICRO_ENDLESS_TONS;
+
+   shuffled_ports = malloc(so_porti * sizeof(int));
+   for(i=0; i<so_porti; i++) {
+      shuffled_ports[i] = i;
+   }
+   for(i=so_porti-1; i>0; i--) {
+      j = random_below(&fixture_random, i + 1);
+      id = shuffled_ports[i];
+      shuffled_ports[i] = shuffled_ports[j];
+      shuffled_ports[j] = id;
+   }
+   for(i=0; i<MICRO_POSITIONS; i++) {
+      positions[i].coord_x = random_unit(&fixture_random) * so_lato;
+      positions[i].coord_y = random_unit(&fixture_random) * so_lato;
+   }
+
+   /* The ship, empty */
+   ship_malloc();
+   lanes_table = malloc(LANE_TABLE_SIZE * sizeof(struct lane));
+   for(i=0; i<LANE_TABLE_SIZE; i++) {
+      lanes_table[i].origin = -1;
+   }
+   for(i=0; i<so_porti; i++) {
+      ports_cost[i] = random_unit(&fixture_random);
+   }
+   my_index = 0;
+   ship_mtype = getpid();
+   current_capacity = so_capacity;
+}
+
+/*
+ * This method runs the given microbenchmark (see bench_names) for the given number
+ * of operations and returns the nanoseconds of each of them
+ */
+double run_bench(int bench, int ops) {
+   struct trip_plan trip;
+   struct timespec start;
+   int i;
+
+   switch(bench) {
+      case 0:
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for(i=0; i<ops; i++) {
+            memcpy(sorted_ports, shuffled_ports, so_porti * sizeof(int));
+            ports_merge_sort(0, so_porti-1);
+         }
+         return elapsed_ns(&start) / ops;
+      case 1:
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for(i=0; i<ops; i++) {
+            products_merge_sort(0, port_offers(i % so_porti)-1);
+         }
+         return elapsed_ns(&start) / ops;
+      case 2:
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for(i=0; i<ops; i++) {
+            my_infos = positions[i % MICRO_POSITIONS];
+            if(plan_trip(0, &trip)) {
+               give_reservable(&catalogue[trip.element].reservable, trip.tons);
+            }
+         }
+         return elapsed_ns(&start) / ops;
+      case 3:
+         return bench_reserve(ops);
+      default:
+         return bench_round_trip(ops);
+   }
+}
+
+/*
+ * This method runs the reserve microbenchmark: SO_NAVI processes start together, each of them
+ * reserves and gives back the products offered by the port 0 in turn. Returns the mean of the
+ * nanoseconds of each operation of the processes
+ */
+double bench_reserve(int ops) {
+   struct timespec start;
+   double *results, mean = 0;
+   int *barrier, i, j, id;
+   long taken;
+
+   barrier = fixture_shm(sizeof(int), &id);
+   results = fixture_shm(so_navi * sizeof(double), &id);
+   fflush(stdout);
+   for(i=0; i<so_navi; i++) {
+      switch(fork()) {
+         case -1:
+            perror("fork failed!");
+            exit(EXIT_FAILURE);
+         case 0:
+            my_index = i;
+            current_capacity = MICRO_RESERVE_TONS;
+            __sync_fetch_and_add(barrier, 1);
+            while(__atomic_load_n(barrier, __ATOMIC_ACQUIRE) < so_navi) {
+               sched_yield();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(j=0; j<ops; j++) {
+               if((taken = reserve_product(offered[j % offered_count], 0)) > 0) {
+                  give_reservable(&catalogue[offered[j % offered_count]].reservable, taken);
+               }
+            }
+            results[i] = elapsed_ns(&start) / ops;
+            _exit(EXIT_SUCCESS);
+         default:
+            break;
+      }
+   }
+   while(wait(NULL) != -1 || errno == EINTR);
+
+   for(i=0; i<so_navi; i++) {
+      mean += results[i] / so_navi;
+   }
+   shmdt(barrier);
+   shmdt(results);
+   return mean;
+}
+
+/*
+ * This method runs the round trip microbenchmark: it starts the port 0 (see microbench_port.c),
+ * loads a ton of the product 0 from it and removes it from the hold for the given number
+ * of times, then stops the port. Returns the nanoseconds of each exchange
+ */
+double bench_round_trip(int ops) {
+   char *args[] = {"./microbench_port", NULL}, *env[13];
+   struct timespec start;
+   double result;
+   pid_t port;
+   int i;
+
+   ports_infos[0].msg_queue_id = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+   ports_infos[0].port_pid = 0;
+   for(i=0; i<12; i++) {
+      env[i] = malloc(24);
+   }
+   sprintf(env[0], "%d", shm_id);
+   sprintf(env[1], "%d", -1);
+   sprintf(env[2], "%d", so_porti);
+   sprintf(env[3], "%d", so_merci);
+   sprintf(env[4], "%d", MICRO_SIZE);
+   sprintf(env[5], "%d", MICRO_MIN_VITA);
+   sprintf(env[6], "%d", MICRO_MAX_VITA);
+   sprintf(env[7], "%d", so_banchine);
+   sprintf(env[8], "%d", 0);
+   sprintf(env[9], "%d", ports_stats_shm_id);
+   sprintf(env[10], "%d", prod_stats_shm_id);
+   sprintf(env[11], "%d", header_shm_id);
+   env[12] = NULL;
+
+   fflush(stdout);
+   if((port = fork()) == -1) {
+      perror("fork failed!");
+      exit(EXIT_FAILURE);
+   } else if(port == 0) {
+      execve("./microbench_port", args, env);
+      perror("execve microbench_port error");
+      exit(EXIT_FAILURE);
+   }
+
+   /* The port sets its pid when it's ready */
+   while(__atomic_load_n(&ports_infos[0].port_pid, __ATOMIC_ACQUIRE) != port) {
+      sched_yield();
+   }
+
+   port_dest_index = 0;
+   so_loadspeed = MICRO_ENDLESS_TONS;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   for(i=0; i<ops; i++) {
+      load_unload_product(0, 1, 0);
+      remove_cargo_tons(0, 1, 0);
+   }
+   result = elapsed_ns(&start) / ops;
+   current_capacity = so_capacity;
+   so_loadspeed = MICRO_LOADSPEED;
+
+   kill(port, SIGUSR1);
+   while(waitpid(port, NULL, 0) == -1 && errno == EINTR);
+   msgctl(ports_infos[0].msg_queue_id, IPC_RMID, NULL);
+   for(i=0; i<12; i++) {
+      free(env[i]);
+   }
+   return result;
+}
+
+/*
+ * This method returns the nanoseconds elapsed from the given instant (CLOCK_MONOTONIC)
+ */
+double elapsed_ns(struct timespec *start) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/*
+ * This method prints the mean of the nanoseconds of each operation of the runs of the given
+ * microbenchmark, with its 95% confidence interval (Student's t), and the fastest run
+ */
+void report(int bench, double *samples, int runs) {
+   const double t_values[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+   double mean = 0, variance = 0, min = samples[0];
+   int i;
+
+   for(i=0; i<runs; i++) {
+      mean += samples[i] / runs;
+      if(samples[i] < min) {
+         min = samples[i];
+      }
+   }
+   for(i=0; i<runs; i++) {
+      variance += (samples[i] - mean) * (samples[i] - mean) / (runs - 1);
+   }
+
+   printf("%-14s %12.1f ns/op +- %.1f (95%%), fastest run: %.1f ns/op\n", bench_names[bench], mean,
+      (runs - 1 <= 30 ? t_values[runs - 2] : 1.96) * sqrt(variance / runs), min);
+}
@@ -0,0 +1,43 @@
+#include "utils.h"
+
+/*
+ * The port of the round trip microbenchmark (see microbench.c): it's started by the microbenchmark
+ * with the env vars of a port and the shared memory of its fixture, then it serves the ships as
+ * a port process does (see handle_swap) until it gets SIGUSR1
+ */
+
+extern __thread int my_index;
+extern __thread struct product *my_products;
+extern __thread int my_products_count;
+extern struct port_info *ports_infos;
+extern struct product *catalogue;
+
+void setup_env_vars();
+void setup_local_structs_and_ipcs();
+void setup_lots();
+int add_lot(int, long, int);
+int handle_swap();
+
+int main(int argc, char const *argv[]) {
+   int i;
+
+   setup_env_vars();
+
+   setup_local_structs_and_ipcs();
+
+   /* The port 0 of the fixture, with a lot for each product it offers */
+   my_index = 0;
+   my_products = catalogue;
+   my_products_count = ports_infos[0].products_count;
+   setup_lots();
+   for(i=0; i<my_products_count; i++) {
+      if(my_products[i].type == 0) {
+         add_lot(i, my_products[i].ton, my_products[i].product_life);
+      }
+   }
+   __atomic_store_n(&ports_infos[0].port_pid, getpid(), __ATOMIC_RELEASE);
+
+   while(handle_swap());
+
+   return 0;
+}
@@ -13,14 +13,22 @@
  * 8) so_fill
  * 9) ports_stats_shm_id
  * 10) products_stats_shm_id
+ * 11) header_shm_id
  */
 extern char **environ;
 
 /* Variables, structs, unions and arrays of stats */
-int so_porti, so_merci, so_fill, so_banchine, so_size, so_min_vita, so_max_vita;
-int current_day=0, my_index;
+int so_porti, so_merci, so_banchine, so_size, so_min_vita, so_max_vita;
+long so_fill;
+int current_day=0;
 
-int shm_id, sem_synch_id, ports_stats_shm_id, prod_stats_shm_id;
+/* 
+ * The index of the port: in server mode (see SO_PORT_THREADS) each thread works 
+ * on the port whose message it is handling (see load_port), so it is thread-local
+ */
+__thread int my_index;
+
+int shm_id, sem_synch_id, ports_stats_shm_id, prod_stats_shm_id, header_shm_id;
 
 struct sigaction sa;
 struct sembuf my_semops;
@@ -34,37 +42,121 @@ struct port_stats *all_ports_stats;
 
 struct prod_stats *all_products_stats;
 
+struct shared_header *shared_header;
+
+/* The trace rings in shared memory, NULL if the events are not traced (see struct trace_ring) */
+struct trace_ring *trace_rings = NULL;
+
+/* The lots pool in shared memory (see struct lot) and the generation params */
+struct lot *lots_pool;
+int lots_per_port, so_gen_period, so_gen_fill;
+
+/* 
+ * The catalogues of the ports in shared memory and the catalogue of this port, 
+ * that is the list of the products that it offers or demands (see struct shared_header)
+ */
+struct product *catalogue;
+__thread struct product *my_products;
+__thread int my_products_count;
+int catalogue_stride;
+
+/* 
+ * The streams of random numbers of the ports (see struct random_state) and the one of 
+ * the current port: in server mode this process draws for every port (see load_port)
+ */
+struct random_state *ports_random;
+__thread struct random_state *my_random;
+
+/*
+ * Server mode: the id of the message queue shared by all the ports and, for each port, the state 
+ * of the exchange in progress. As in process mode, a port serves one ship at a time:
+ *    - the mutex of the port, taken by the thread that handles a message for the port
+ *    - 1 if the port is waiting for the confirmation of an exchange, 0 otherwise
+ *    - the index in the catalogue of the exchanged product and the tons requested by the ship
+ *    - the requests received during the exchange, in order of arrival
+ */
+struct pending_request {
+   struct my_msgbuf request;
+   struct pending_request *next;
+};
+
+struct port_server_state {
+   pthread_mutex_t lock;
+   int busy;
+   int prod_ind;
+   long requested;
+   struct pending_request *first_pending, *last_pending;
+};
+
+int server_queue_id = -1;
+struct port_server_state *server_states;
+
 /* Methods */
 void setup_env_vars();
 void setup_local_structs_and_ipcs();
-void create_products(int, int, int);
-void notify_master_for_synch();
+void port_register(int);
+int compare_ids(const void *, const void *);
+void setup_product(int, int, long);
+void create_products();
+void notify_master_for_synch(int);
+void wait_simulation_start(int);
 void port_local_free();
 void check_expired_products();
+void new_day();
 int handle_swap();
-
+int serve_request(struct my_msgbuf *);
+void serve_confirmation(struct my_ackbuf *, int, long);
+
+void run_port_server();
+void *port_server_worker(void *);
+void load_port(int);
+void start_exchange(struct port_server_state *, struct my_msgbuf *);
+
+void setup_lots();
+int lot_alloc();
+void lot_free(int);
+int add_lot(int, long, int);
+void ship_lots(int, long);
+void change_reservable_tons(long *, long);
+void generate_products();
+void port_trace(int, int, long);
+
+/* The microbenchmarks link the methods of the port without its main (see microbench_port.c) */
+#ifndef MICROBENCH
 int main(int argc, char const *argv[]) {
    int i;
-   struct sembuf start;
 
    setup_env_vars();
 
    setup_local_structs_and_ipcs();
 
-   create_products(so_size, so_min_vita, so_max_vita);
+   /* 
+    * In zygote mode this process was the only port started by the master:
+    * every other port is forked from here, inheriting the setup done so far 
+    * (in server mode this process hosts all the ports)
+    */
+   if(shared_header->config.SO_ZYGOTE && shared_header->config.SO_PORT_THREADS <= 0) {
+      spawn_processes(so_porti);
+   }
+
+   if(shared_header->config.SO_PORT_THREADS > 0) {
+      run_port_server();
+      return 0;
+   }
 
-   notify_master_for_synch();
+   port_register(-1);
 
-   start.sem_num = 2;
-   start.sem_op = -1;
-   start.sem_flg = 0;
+   create_products();
+
+   notify_master_for_synch(1);
 
-   semop(sem_synch_id, &start, 1);
+   wait_simulation_start(1);
 
    while(handle_swap());
    
    return 0;
 }
+#endif
 
 void handle_signal(int signum) {
    switch (signum) {
@@ -74,7 +166,7 @@ void handle_signal(int signum) {
          break;
       case SIGUSR2:
          current_day++;
-         check_expired_products();
+         new_day();
          break;
       case SIGINT:
          port_local_free();
@@ -98,14 +190,17 @@ void setup_env_vars() {
    so_min_vita = atoi(environ[5]);
    so_max_vita = atoi(environ[6]);
    so_banchine = atoi(environ[7]);
-   so_fill = atoi(environ[8]);
+   so_fill = atol(environ[8]);
    ports_stats_shm_id = atoi(environ[9]);
    prod_stats_shm_id = atoi(environ[10]);
+   header_shm_id = atoi(environ[11]);
 }
 
+/*
+ * This method sets up the signals and attaches the shared memory: in zygote mode
+ * it is executed only once and its results are shared by all the ports
+ */
 void setup_local_structs_and_ipcs() {
-   int i, msg_id, cont = 1;
-
    bzero(&sa, sizeof(sa));
    sa.sa_handler = handle_signal;
    sigaction(SIGUSR1, &sa, NULL);
@@ -113,340 +208,721 @@ void setup_local_structs_and_ipcs() {
    sigaction(SIGINT, &sa, NULL);
    sigaction(SIGTERM, &sa, NULL);
 
-   srand(getpid());
-
-   all_ports_stats = (struct port_stats *)shmat(ports_stats_shm_id, NULL, 0);
+   all_ports_stats = (struct port_stats *)ipc_shmat(ports_stats_shm_id, NULL, 0);
 
-   all_products_stats = (struct prod_stats *)shmat(prod_stats_shm_id, NULL, 0);
+   all_products_stats = (struct prod_stats *)ipc_shmat(prod_stats_shm_id, NULL, 0);
 
-   ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
+   ports_infos = (struct port_info *)ipc_shmat(shm_id, NULL, 0);
    if (ports_infos == (struct port_info *)-1) {
       printf("Error during shmat in port.c\n");
       perror("shmat");
    }
 
-   /* Setup the semaphore that represents the quays  */
-   for(i=0; i<so_porti && cont; i++) {
-      if(ports_infos[i].port_pid == getpid()) {
-         my_index = i;
-         so_banchine = 1 + (rand() % so_banchine);
+   shared_header = (struct shared_header *)ipc_shmat(header_shm_id, NULL, 0);
 
-         ports_infos[i].quays_id = semget(IPC_PRIVATE, 1, 0666);
-         my_infos.quays_id = ports_infos[i].quays_id;
-         my_semaphore_arg.val = so_banchine;
+   catalogue = (struct product *) ipc_shmat(shared_header->catalogue_shm_id, NULL, 0);
+   catalogue_stride = shared_header->catalogue_stride;
 
-         if(semctl(ports_infos[i].quays_id, 0, SETVAL, my_semaphore_arg) == -1) {
-            perror("Error setting semaphore value");
-            exit(EXIT_FAILURE);
-         }
+   lots_pool = (struct lot *)ipc_shmat(shared_header->lots_shm_id, NULL, 0);
+   lots_per_port = shared_header->lots_per_port;
+   so_gen_period = shared_header->config.SO_GEN_PERIOD;
+   so_gen_fill = shared_header->config.SO_GEN_FILL;
 
-         msg_id = msgget(IPC_PRIVATE, 0666);
-         ports_infos[i].msg_queue_id = msg_id;
-         my_infos.msg_queue_id = msg_id;
+   if(shared_header->trace_shm_id != -1) {
+      trace_rings = (struct trace_ring *)ipc_shmat(shared_header->trace_shm_id, NULL, 0);
+   }
 
-         all_ports_stats[my_index].total_quays = so_banchine;
-         all_ports_stats[my_index].occupied_quays = 0;
-         cont = 0;
-      }
+   ports_random = malloc(so_porti * sizeof(struct random_state));
+}
+
+/*
+ * This method traces an event of the current port in its trace ring, if the events are traced
+ */
+void port_trace(int type, int product, long tons) {
+   if(trace_rings != NULL) {
+      trace_emit(shared_header, &trace_rings[my_index], type, my_index, product, tons);
    }
 }
 
-void create_products(int so_size, int so_min_vita, int so_max_vita) {
-   int i, first_offer_ind = 0, first_demand_ind = 0, tons = 0, life = 0;
-   int current_fill_offer = 0, current_fill_demand = 0;
+/*
+ * This method sets up the infos of this port: its index, its quays, its message queue (a new one
+ * if "msg_id" is -1) and its lots
+ */
+void port_register(int msg_id) {
+   int quays;
 
-   ports_infos[my_index].my_products_offer = 
-      (struct product *) shmat(ports_infos[my_index].off_shm_id, NULL, 0);
-   ports_infos[my_index].my_products_demand = 
-      (struct product *) shmat(ports_infos[my_index].dem_shm_id, NULL, 0);
+   /* Taking my index and setting up the semaphore that represents the quays */
+   my_index = __sync_fetch_and_add(&shared_header->ports_count, 1);
+   ports_infos[my_index].port_pid = getpid();
+   my_random = &ports_random[my_index];
+   random_seed(my_random, shared_header->config.SO_SEED, IPC_ROLE_PORT, my_index);
 
-   /*
-    * 
-    * In this phase we want to make sure that the port offers and demands 
-    * at least one product: we draw 2 indexes included in the interval [0 ; SO_MERCI-1]
-    * 
-    */
+   quays = 1 + random_below(my_random, so_banchine);
 
-   /* First offer */
+   my_semaphore_arg.val = quays;
 
-   first_offer_ind = rand() % so_merci;
+   if(ipc_semctl(shared_header->quays_sem_id, my_index, SETVAL, my_semaphore_arg) == -1) {
+      perror("Error setting semaphore value");
+      exit(EXIT_FAILURE);
+   }
 
-   ports_infos[my_index].my_products_offer[first_offer_ind].product_id = first_offer_ind;
-   ports_infos[my_index].my_products_demand[first_offer_ind].product_id = first_offer_ind;
-   
-   tons = 1 + (rand() % so_size);
-   current_fill_offer += tons;
-   ports_infos[my_index].my_products_offer[first_offer_ind].ton = tons;
-   all_ports_stats[my_index].tons_available += tons;
-   ports_infos[my_index].my_products_demand[first_offer_ind].ton = 0;
+   if(msg_id == -1) {
+      msg_id = msgget(IPC_PRIVATE, 0666);
+   }
+   ports_infos[my_index].msg_queue_id = msg_id;
+   my_infos.msg_queue_id = msg_id;
 
-   life = so_min_vita + (rand() % (so_max_vita-so_min_vita+1));
-   ports_infos[my_index].my_products_offer[first_offer_ind].product_life = life;
-   ports_infos[my_index].my_products_demand[first_offer_ind].product_life = 0;
+   all_ports_stats[my_index].total_quays = quays;
+   all_ports_stats[my_index].occupied_quays = 0;
 
-   ports_infos[my_index].my_products_offer[first_offer_ind].status = 1;
-   ports_infos[my_index].my_products_demand[first_offer_ind].status = 0;
+   setup_lots();
+}
 
-   ports_infos[my_index].my_products_offer[first_offer_ind].product_semaphore =
-      semget(IPC_PRIVATE, 1, 0666);
-   my_semaphore_arg.val = ports_infos[my_index].my_products_offer[first_offer_ind].ton;
-   semctl(ports_infos[my_index].my_products_offer[first_offer_ind].product_semaphore, 0, SETVAL, my_semaphore_arg);
-   ports_infos[my_index].my_products_demand[first_offer_ind].product_semaphore = -1;
+/*
+ * This method puts every lot owned by the port in the list of free lots
+ */
+void setup_lots() {
+   int i, first;
 
-   /* First demand */
+   first = my_index * lots_per_port;
+   for(i=first; i<first + lots_per_port - 1; i++) {
+      lots_pool[i].next = i + 1;
+   }
+   lots_pool[first + lots_per_port - 1].next = -1;
+   ports_infos[my_index].free_lot = first;
+}
 
-   do {
-      first_demand_ind = rand() % so_merci;
-   } while (first_demand_ind == first_offer_ind);
+/*
+ * This method takes a lot from the list of free lots of the port and returns its index,
+ * -1 if the port has no free lots
+ */
+int lot_alloc() {
+   int lot = ports_infos[my_index].free_lot;
 
-   ports_infos[my_index].my_products_demand[first_demand_ind].product_id = first_demand_ind;
-   ports_infos[my_index].my_products_offer[first_demand_ind].product_id = first_demand_ind;
-   
-   tons = 1 + (rand() % so_size);
-   current_fill_demand += tons;
-   ports_infos[my_index].my_products_demand[first_demand_ind].ton = tons;
-   ports_infos[my_index].my_products_offer[first_demand_ind].ton = 0;
+   if(lot != -1) {
+      ports_infos[my_index].free_lot = lots_pool[lot].next;
+      lots_pool[lot].next = -1;
+   }
+
+   return lot;
+}
 
-   ports_infos[my_index].my_products_demand[first_demand_ind].product_life = 0;
-   ports_infos[my_index].my_products_offer[first_demand_ind].product_life = 0;
+/*
+ * This method puts the given lot back in the list of free lots of the port
+ */
+void lot_free(int lot) {
+   lots_pool[lot].ton = 0;
+   lots_pool[lot].next = ports_infos[my_index].free_lot;
+   ports_infos[my_index].free_lot = lot;
+}
 
-   ports_infos[my_index].my_products_demand[first_demand_ind].status = 0;
-   ports_infos[my_index].my_products_offer[first_demand_ind].status = 0;
+/*
+ * This method adds a new lot to the offer of the given product (index in the catalogue of the port), 
+ * keeping the lots ordered by product_life, and updates the life of the product. It doesn't update 
+ * the tons of the product. Returns the index of the lot, -1 if the port has no free lots
+ */
+int add_lot(int prod_ind, long tons, int life) {
+   int lot, *curr;
 
-   ports_infos[my_index].my_products_demand[first_demand_ind].product_semaphore =
-      semget(IPC_PRIVATE, 1, 0666);
-   my_semaphore_arg.val = ports_infos[my_index].my_products_demand[first_demand_ind].ton;
-   semctl(ports_infos[my_index].my_products_demand[first_demand_ind].product_semaphore, 0, SETVAL, my_semaphore_arg);
-   ports_infos[my_index].my_products_offer[first_demand_ind].product_semaphore = -1;
+   if((lot = lot_alloc()) == -1) {
+      return -1;
+   }
 
-   /* 
+   lots_pool[lot].ton = tons;
+   lots_pool[lot].product_life = life;
+
+   curr = &my_products[prod_ind].first_lot;
+   while(*curr != -1 && lots_pool[*curr].product_life <= life) {
+      curr = &lots_pool[*curr].next;
+   }
+   lots_pool[lot].next = *curr;
+   *curr = lot;
+
+   my_products[prod_ind].product_life = lots_pool[my_products[prod_ind].first_lot].product_life;
+
+   return lot;
+}
+
+/*
+ * This method removes the given tons from the lots of the given product (index in the catalogue
+ * of the port), starting from the lots that expire first, and updates the life of the product
+ */
+void ship_lots(int prod_ind, long tons) {
+   struct product *prod = &my_products[prod_ind];
+   int lot;
+   long taken;
+
+   while(tons > 0 && (lot = prod->first_lot) != -1) {
+      taken = (lots_pool[lot].ton < tons) ? lots_pool[lot].ton : tons;
+      lots_pool[lot].ton -= taken;
+      tons -= taken;
+      if(lots_pool[lot].ton == 0) {
+         prod->first_lot = lots_pool[lot].next;
+         lot_free(lot);
+      }
+   }
+
+   prod->product_life = (prod->first_lot != -1) ? lots_pool[prod->first_lot].product_life : 0;
+}
+
+/*
+ * This method adds (or removes, if "tons" is negative) the given tons to the reservable counter of 
+ * a product, that is the quantity that the ships can still reserve. When removing tons, the counter
+ * is decreased at most to 0 since the remaining tons might have been already reserved by some ships
+ */
+void change_reservable_tons(long *reservable, long tons) {
+   if(tons >= 0) {
+      give_reservable(reservable, tons);
+   } else {
+      take_reservable(reservable, -tons);
+   }
+}
+
+/*
+ * This method generates new offer and demand at run-time. The port adds at most
+ * SO_GEN_FILL tons to its offer and to its demand, without exceeding its share of SO_FILL:
+ * each offered product gets at most one new lot, while the new demand is added to the 
+ * demanded products drawn randomly
+ */
+void generate_products() {
+   int i, j, life;
+   long tons, budget, total_demand = 0;
+
+   budget = so_fill - all_ports_stats[my_index].tons_available;
+   if(budget > so_gen_fill) {
+      budget = so_gen_fill;
+   }
+
+   for(j=0, i=random_below(my_random, my_products_count); j<my_products_count && budget > 0; j++, i = (i + 1) % my_products_count) {
+      if(my_products[i].type == 0) {
+         tons = 1 + random_below(my_random, so_size);
+         if(tons > budget) {
+            tons = budget;
+         }
+         life = current_day + so_min_vita + random_below(my_random, so_max_vita-so_min_vita+1);
+         if(add_lot(i, tons, life) == -1) {
+            break;
+         }
+         my_products[i].ton += tons;
+         my_products[i].status = 1;
+         change_reservable_tons(&my_products[i].reservable, tons);
+
+         stats_update_begin(shared_header);
+         all_ports_stats[my_index].tons_available += tons;
+         __sync_fetch_and_add(&all_products_stats[my_products[i].product_id].available_port, tons);
+         __sync_fetch_and_add(&all_products_stats[my_products[i].product_id].generated, tons);
+         stats_update_end(shared_header);
+         port_trace(TRACE_GENERATE, my_products[i].product_id, tons);
+         budget -= tons;
+      }
+   }
+
+   for(i=0; i<my_products_count; i++) {
+      if(my_products[i].type == 1) {
+         total_demand += my_products[i].ton;
+      }
+   }
+   budget = so_fill - total_demand;
+   if(budget > so_gen_fill) {
+      budget = so_gen_fill;
+   }
+
+   for(j=0, i=random_below(my_random, my_products_count); j<my_products_count && budget > 0; j++, i = (i + 1) % my_products_count) {
+      if(my_products[i].type == 1) {
+         tons = 1 + random_below(my_random, so_size);
+         if(tons > budget) {
+            tons = budget;
+         }
+         my_products[i].ton += tons;
+         change_reservable_tons(&my_products[i].reservable, tons);
+         budget -= tons;
+      }
+   }
+}
+
+/*
+ * This method compares two product ids, it is used to order the catalogue of the port
+ */
+int compare_ids(const void *a, const void *b) {
+   return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * This method sets up the offer and the demand of a single product of the catalogue,
+ * the life of an offered product is set by its lots (see create_products)
+ */
+void setup_product(int prod_ind, int type, long tons) {
+   my_products[prod_ind].type = type;
+   my_products[prod_ind].ton = tons;
+   my_products[prod_ind].product_life = 0;
+   if(type == 0) {
+      my_products[prod_ind].status = 1;
+      all_ports_stats[my_index].tons_available += tons;
+   } else {
+      my_products[prod_ind].status = 0;
+   }
+
+   my_products[prod_ind].reservable = tons;
+}
+
+/*
+ * This method sets up the catalogue of the port: the work is linear in the number of products
+ * and in the number of lots of the initial offer (SO_FILL / SO_SIZE at most, plus one for each product)
+ */
+void create_products() {
+   int i, j, k, t, first_offer_ind = -1, first_demand_ind = -1;
+   long tons = 0, left, weights[2] = {0, 0}, current_fill[2] = {0, 0};
+   int *ids;
+
+   my_products = catalogue + my_index * catalogue_stride;
+   my_products_count = catalogue_stride;
+
+   /*
     * 
-    * In this phase we setup the two arrays without worring about the SO_FILL value: we flip a
-    * coin in order to decide if the current product is going to go in the offer or demand array.
-    * We are going to skip the previously valued offer and demand
+    * In this phase we choose the products of the catalogue: all the SO_MERCI products or
+    * SO_ACTIVE_MERCI of them, drawn with the Floyd's algorithm so that the work doesn't 
+    * depend on SO_MERCI. The catalogue is ordered by product_id
     * 
     */
 
-   for(i=0; i<so_merci; i++) {
-      if(i != first_offer_ind && i != first_demand_ind) {
-         ports_infos[my_index].my_products_offer[i].product_id = i;
-         ports_infos[my_index].my_products_demand[i].product_id = i;
-         if(rand() % 2) { /* Coin flip -> port will offer this product*/
-            do {
-               tons = 1 + (rand() % so_size);
-            } while( (current_fill_offer + tons) > so_fill);
-
-            current_fill_offer += tons;
-            
-            ports_infos[my_index].my_products_offer[i].ton = tons;
-            all_ports_stats[my_index].tons_available += tons;
-            ports_infos[my_index].my_products_demand[i].ton = 0;
-
-            life = so_min_vita + (rand() % (so_max_vita-so_min_vita+1));
-            ports_infos[my_index].my_products_offer[i].product_life = life;
-            ports_infos[my_index].my_products_demand[i].product_life = 0;
-
-            ports_infos[my_index].my_products_offer[i].status = 1;
-            ports_infos[my_index].my_products_demand[i].status = 0;
-
-            ports_infos[my_index].my_products_offer[i].product_semaphore =
-               semget(IPC_PRIVATE, 1, 0666);
-            my_semaphore_arg.val = ports_infos[my_index].my_products_offer[i].ton;
-            semctl(ports_infos[my_index].my_products_offer[i].product_semaphore, 0, SETVAL, my_semaphore_arg);
-            ports_infos[my_index].my_products_demand[i].product_semaphore = -1;
-
-         } else { /* Port will demand this product */
-            do {
-               tons = 1 + (rand() % so_size);
-            } while( (current_fill_demand + tons) > so_fill);
-
-            current_fill_demand += tons;
-            
-            ports_infos[my_index].my_products_demand[i].ton = tons;
-            ports_infos[my_index].my_products_offer[i].ton = 0;
-
-            ports_infos[my_index].my_products_demand[i].product_life = 0;
-            ports_infos[my_index].my_products_offer[i].product_life = 0;
-
-            ports_infos[my_index].my_products_demand[i].status = 0;
-            ports_infos[my_index].my_products_offer[i].status = 0;
-
-            ports_infos[my_index].my_products_demand[i].product_semaphore =
-               semget(IPC_PRIVATE, 1, 0666);
-            my_semaphore_arg.val = ports_infos[my_index].my_products_demand[i].ton;
-            semctl(ports_infos[my_index].my_products_demand[i].product_semaphore, 0, SETVAL, my_semaphore_arg);
-            ports_infos[my_index].my_products_offer[i].product_semaphore = -1;
-         }
+   ids = malloc(my_products_count * sizeof(int));
+   if(my_products_count == so_merci) {
+      for(i=0; i<my_products_count; i++) {
+         ids[i] = i;
       }
+   } else {
+      for(i=0, j=so_merci-my_products_count; j<so_merci; i++, j++) {
+         t = random_below(my_random, j + 1);
+         for(k=0; k<i && ids[k] != t; k++);
+         ids[i] = (k < i) ? j : t;
+      }
+      qsort(ids, my_products_count, sizeof(int), compare_ids);
+   }
+
+   for(i=0; i<my_products_count; i++) {
+      my_products[i].product_id = ids[i];
+      my_products[i].first_lot = -1;
    }
+   free(ids);
 
    /*
     * 
-    * In this phase we will verify if the port reaches the SO_FILL quantity
-    * for both the offer and the demand: if it doesn't we will go the first valued 
-    * product in the array of interest and we will increase the tons in order to
-    * reach the designated quantity
+    * In this phase we choose the type of each product: the port offers and demands 
+    * at least one product (we draw 2 different indexes of the catalogue), for the others 
+    * we flip a coin. A port with a single product flips the coin for it too. Each product 
+    * also gets a weight between 1 and SO_SIZE, stored for now in its tons
     * 
     */
 
-   if(current_fill_offer < so_fill) {
-      ports_infos[my_index].my_products_offer[first_offer_ind].ton += so_fill - current_fill_offer;
-      my_semaphore_arg.val = ports_infos[my_index].my_products_offer[first_offer_ind].ton;
-      semctl(ports_infos[my_index].my_products_offer[first_offer_ind].product_semaphore, 0, SETVAL, my_semaphore_arg);
-      all_ports_stats[my_index].tons_available += so_fill - current_fill_offer;
-      current_fill_offer = so_fill;
+   if(my_products_count > 1) {
+      first_offer_ind = random_below(my_random, my_products_count);
+      first_demand_ind = (first_offer_ind + 1 + random_below(my_random, my_products_count - 1)) % my_products_count;
    }
-   if(current_fill_demand < so_fill) {
-      ports_infos[my_index].my_products_demand[first_demand_ind].ton += so_fill - current_fill_demand;
-      my_semaphore_arg.val = ports_infos[my_index].my_products_demand[first_demand_ind].ton;
-      semctl(ports_infos[my_index].my_products_demand[first_demand_ind].product_semaphore, 0, SETVAL, my_semaphore_arg);
+
+   for(i=0; i<my_products_count; i++) {
+      if(i == first_offer_ind) {
+         my_products[i].type = 0;
+      } else if(i == first_demand_ind) {
+         my_products[i].type = 1;
+      } else {
+         my_products[i].type = random_below(my_random, 2);
+      }
+      my_products[i].ton = 1 + random_below(my_random, so_size);
+      weights[my_products[i].type] += my_products[i].ton;
+   }
+
+   /*
+    * 
+    * In this phase we split SO_FILL among the offered products and among the demanded ones, 
+    * proportionally to their weights (a multinomial split done in a single pass). The tons
+    * left by the rounding, fewer than the products, are given one by one starting from a 
+    * random product
+    * 
+    */
+
+   for(i=0; i<my_products_count; i++) {
+      t = my_products[i].type;
+      tons = so_fill * my_products[i].ton / weights[t];
+      current_fill[t] += tons;
+      setup_product(i, t, tons);
+   }
+
+   for(j=0, i=random_below(my_random, my_products_count); j<my_products_count; j++, i = (i + 1) % my_products_count) {
+      t = my_products[i].type;
+      if(current_fill[t] < so_fill) {
+         current_fill[t]++;
+         my_products[i].ton++;
+         my_products[i].reservable++;
+         if(t == 0) {
+            all_ports_stats[my_index].tons_available++;
+         }
+      }
+   }
+
+   /* 
+    * The initial offer of each product is split in lots of at most SO_SIZE tons, 
+    * each one with its own life
+    */
+   for(i=0; i<my_products_count; i++) {
+      if(my_products[i].type == 0) {
+         for(left = my_products[i].ton; left > 0; left -= tons) {
+            tons = (left < so_size) ? left : so_size;
+            add_lot(i, tons, so_min_vita + random_below(my_random, so_max_vita-so_min_vita+1));
+         }
+      }
    }
+
+   ports_infos[my_index].products_count = my_products_count;
 }
 
 /*
- * This method is used to notify the master and let him know that
- * my setup phase is complete and that I'm ready to start
+ * This method is used to notify the master and let him know that the setup phase 
+ * of the given number of ports is complete and that they are ready to start
  */
-void notify_master_for_synch() {
+void notify_master_for_synch(int ports) {
    int sem_id = atoi(environ[1]);
    struct sembuf my_synch;
 
    my_synch.sem_num = 0;
-   my_synch.sem_op = -1;
+   my_synch.sem_op = -ports;
    my_synch.sem_flg = 0;
 
-   semop(sem_id, &my_synch, 1);
+   ipc_semop(sem_id, &my_synch, 1);
 }
 
-void port_local_free() { 
+/*
+ * This method waits for the master to start the simulation
+ */
+void wait_simulation_start(int ports) {
+   struct sembuf start;
 
-   semctl(ports_infos[my_index].quays_id, 0, IPC_RMID);
+   start.sem_num = 2;
+   start.sem_op = -ports;
+   start.sem_flg = 0;
 
-   shmdt(ports_infos[my_index].my_products_offer);
-   shmctl(ports_infos[my_index].off_shm_id, IPC_RMID, NULL);
+   ipc_semop(sem_synch_id, &start, 1);
+}
+
+void port_local_free() { 
+   ipc_shmdt(catalogue);
 
-   shmdt(ports_infos[my_index].my_products_demand);
-   shmctl(ports_infos[my_index].dem_shm_id, IPC_RMID, NULL);
+   ipc_shmdt(lots_pool);
 
-   shmdt(ports_infos);
+   ipc_shmdt(ports_infos);
+
+   ipc_stats_publish(shared_header, IPC_ROLE_PORT);
 }
 
+/*
+ * This method removes from the offer the lots that just expired. Only the tons that no ship
+ * reserved expire: the reserved ones stay in their lot until the exchange ships them or the
+ * ship gives them back, then they expire on the next day
+ */
 void check_expired_products() {
-   int i, val;
-
-   ports_infos[my_index].my_products_offer = 
-      (struct product *) shmat(ports_infos[my_index].off_shm_id, NULL, 0);
-   
-   for(i=0; i<so_merci; i++) {
-      if(ports_infos[my_index].my_products_offer[i].ton > 0 && ports_infos[my_index].my_products_offer[i].status == 1) {
-         if(ports_infos[my_index].my_products_offer[i].product_life <= current_day) {
-            val = semctl(ports_infos[my_index].my_products_offer[i].product_semaphore, 0, GETVAL);
-            all_ports_stats[my_index].tons_available -= val;
-            all_ports_stats[my_index].tons_expired += val;
-            all_products_stats[i].available_port -= val;
-            all_products_stats[i].expired_port += val;
-            my_semaphore_arg.val = 0;
-            semctl(ports_infos[my_index].my_products_offer[i].product_semaphore, 0, SETVAL, my_semaphore_arg);
-            ports_infos[my_index].my_products_offer[i].status = 4;
-            ports_infos[my_index].my_products_offer[i].ton = 0;
+   int i, lot, *curr;
+   long expired;
+   struct product *prod;
+
+   for(i=0; i<my_products_count; i++) {
+      prod = &my_products[i];
+      if(prod->type == 0 && prod->ton > 0 && prod->status == 1) {
+         curr = &prod->first_lot;
+         while((lot = *curr) != -1 && lots_pool[lot].product_life <= current_day) {
+            expired = take_reservable(&prod->reservable, lots_pool[lot].ton);
+            if(expired > 0) {
+               stats_update_begin(shared_header);
+               all_ports_stats[my_index].tons_available -= expired;
+               all_ports_stats[my_index].tons_expired += expired;
+               __sync_fetch_and_sub(&all_products_stats[prod->product_id].available_port, expired);
+               __sync_fetch_and_add(&all_products_stats[prod->product_id].expired_port, expired);
+               stats_update_end(shared_header);
+               port_trace(TRACE_PORT_EXPIRE, prod->product_id, expired);
+               prod->ton -= expired;
+               lots_pool[lot].ton -= expired;
+            }
+            if(lots_pool[lot].ton == 0) {
+               *curr = lots_pool[lot].next;
+               lot_free(lot);
+            } else {
+               curr = &lots_pool[lot].next;
+            }
+         }
+         if(prod->first_lot == -1) {
+            prod->status = 4;
+            prod->ton = 0;
+            prod->product_life = 0;
+         } else {
+            prod->product_life = lots_pool[prod->first_lot].product_life;
          }
       }
    }
 }
 
+/*
+ * This method handles an exchange with a ship: it waits for a request, replies and, if the
+ * request was accepted, waits for the confirmation of the ship
+ */
 int handle_swap() {
-   struct my_msgbuf new_req, new_ack;
+   struct my_msgbuf new_req;
    struct my_ackbuf confirmation;
-   sigset_t my_mask;
+   int prod_ind;
 
    /* Waiting for a message from a ship */
 
-   while(msgrcv(ports_infos[my_index].msg_queue_id, &new_req, sizeof(struct my_msgbuf) - sizeof(long), 1, 0) == -1);
+   while(ipc_msgrcv(ports_infos[my_index].msg_queue_id, &new_req, sizeof(struct my_msgbuf) - sizeof(long), 1, 0) == -1);
 
-   if(new_req.type == 0) {
-      ports_infos[my_index].my_products_offer = (struct product *)shmat(ports_infos[my_index].off_shm_id, NULL, 0);
+   /* 
+    * If the request was not idoneus, about to restart the method and wait for another message
+    */
+   if((prod_ind = serve_request(&new_req)) == -1) {
+      return 1;
+   }
 
-      if(ports_infos[my_index].my_products_offer[new_req.prod_id].product_life <= current_day ||
-         ports_infos[my_index].my_products_offer[new_req.prod_id].ton < new_req.tons) {
+   /*
+    * The request was idoneous, now waiting for the ship communication that regards
+    * the end of the nanosleep that represents the exchange of the product
+    */
+
+   while(ipc_msgrcv(ports_infos[my_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), 100, 0) == -1);
+
+   serve_confirmation(&confirmation, prod_ind, new_req.tons);
+
+   return 1;
+}
+
+/*
+ * This method replies to the request of a ship: it returns the index in the catalogue of the 
+ * requested product if the request is idoneus, -1 otherwise
+ */
+int serve_request(struct my_msgbuf *new_req) {
+   struct my_msgbuf new_ack;
+   int prod_ind;
+
+   prod_ind = find_product(my_products, 0, my_products_count, new_req->prod_id);
+
+   if(prod_ind == -1) {
+      new_ack.type = -1;
+   } else if(new_req->type == 0) {
+
+      if(my_products[prod_ind].product_life <= current_day ||
+         my_products[prod_ind].ton < new_req->tons) {
          /* The request is not idoneus */
          new_ack.type = -1;
       } else {
-         new_ack.type = new_req.type;
+         new_ack.type = new_req->type;
       }
    } else {
-      new_ack.type = new_req.type;
+      new_ack.type = new_req->type;
    }
    
-   new_ack.mtype = (long) new_req.sender;
-   new_ack.sender = new_req.sender;
-   new_ack.prod_id = new_req.prod_id;
-   new_ack.tons = new_req.tons;
-
-   while(msgsnd(ports_infos[my_index].msg_queue_id, &new_ack, sizeof(struct my_msgbuf) - sizeof(long), 0) == -1);
-
-   /* 
-    * Just communicated to the demanding ship that the request was not idoneus,
-    * about to restart the method and wait for another message
-    */
-   if(new_ack.type == -1) { 
-      return 1;
+   new_ack.mtype = (long) new_req->sender;
+   new_ack.sender = new_req->sender;
+   new_ack.prod_id = new_req->prod_id;
+   new_ack.tons = new_req->tons;
+   new_ack.port = my_index;
+
+   /* The tons reserved by the ship go back to the port, an expired lot can expire them */
+   if(new_ack.type == -1) {
+      if(prod_ind != -1) {
+         give_reservable(&my_products[prod_ind].reservable, new_req->tons);
+      }
+      port_trace(TRACE_REJECT, new_req->prod_id, new_req->tons);
    }
 
-   /*
-    * The request was idoneous, now waiting for the ship communication that regards
-    * the end of the nanosleep that represents the exchange of the product
-    */
+   while(ipc_msgsnd(ports_infos[my_index].msg_queue_id, &new_ack, sizeof(struct my_msgbuf) - sizeof(long), 0) == -1);
 
-   while(msgrcv(ports_infos[my_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), 100, 0) == -1);
+   return (new_ack.type == -1) ? -1 : prod_ind;
+}
 
+/*
+ * This method handles the confirmation of an exchange of the given product (index in the 
+ * catalogue), for which the ship requested the given tons
+ */
+void serve_confirmation(struct my_ackbuf *confirmation, int prod_ind, long requested) {
+   sigset_t my_mask, old_mask;
+
+   /* 
+    * The mask is restored afterwards: in server mode the threads of the pool must keep 
+    * SIGUSR2 blocked, so that the days are handled only by the main thread
+    */
    sigemptyset(&my_mask);
    sigaddset(&my_mask, SIGUSR2);
-   sigprocmask(SIG_BLOCK, &my_mask, NULL); 
+   pthread_sigmask(SIG_BLOCK, &my_mask, &old_mask); 
 
    /*
-    * Updating local infos and stats
+    * Updating local infos and stats: the tons on the ships are updated here too, so that
+    * the tons leave the port and reach the ship (or the other way round) in a single group
     */
 
-   if(confirmation.type == 0) {
-      all_ports_stats[my_index].tons_available -= confirmation.tons;
-      all_ports_stats[my_index].tons_shipped += confirmation.tons;
-      all_products_stats[confirmation.prod_id].available_port -= confirmation.tons;
+   if(confirmation->type == 0) {
+      stats_update_begin(shared_header);
+      all_ports_stats[my_index].tons_available -= confirmation->tons;
+      all_ports_stats[my_index].tons_shipped += confirmation->tons;
+      __sync_fetch_and_sub(&all_products_stats[confirmation->prod_id].available_port, confirmation->tons);
+      __sync_fetch_and_add(&all_products_stats[confirmation->prod_id].on_ship, confirmation->tons);
+      stats_update_end(shared_header);
 
-      ports_infos[my_index].my_products_offer = 
-         (struct product *) shmat(ports_infos[my_index].off_shm_id, NULL, 0);
+      my_products[prod_ind].ton -= confirmation->tons;
+      ship_lots(prod_ind, confirmation->tons);
 
-      ports_infos[my_index].my_products_offer[confirmation.prod_id].ton -= confirmation.tons;
-
-      if(confirmation.tons != new_req.tons) {
-         my_semaphore_arg.val = semctl(ports_infos[my_index].my_products_offer[confirmation.prod_id].product_semaphore, 0, GETVAL);
-         my_semaphore_arg.val += abs(new_req.tons - confirmation.tons);
-         semctl(ports_infos[my_index].my_products_offer[confirmation.prod_id].product_semaphore, 0, SETVAL, my_semaphore_arg);
+      if(confirmation->tons != requested) {
+         give_reservable(&my_products[prod_ind].reservable, requested - confirmation->tons);
       }
    } else {
-      all_ports_stats[my_index].tons_delivered += confirmation.tons;
-      all_products_stats[confirmation.prod_id].delivered += confirmation.tons;
-
-      ports_infos[my_index].my_products_demand = 
-         (struct product *) shmat(ports_infos[my_index].dem_shm_id, NULL, 0);
-
-      ports_infos[my_index].my_products_demand[confirmation.prod_id].ton =
-         ports_infos[my_index].my_products_demand[confirmation.prod_id].ton - confirmation.tons;
-      if(confirmation.tons != new_req.tons) {
-         my_semaphore_arg.val = semctl(ports_infos[my_index].my_products_demand[confirmation.prod_id].product_semaphore, 0, GETVAL);
-         my_semaphore_arg.val += abs(new_req.tons - confirmation.tons);
-         semctl(ports_infos[my_index].my_products_demand[confirmation.prod_id].product_semaphore, 0, SETVAL, my_semaphore_arg);
+      stats_update_begin(shared_header);
+      all_ports_stats[my_index].tons_delivered += confirmation->tons;
+      __sync_fetch_and_add(&all_products_stats[confirmation->prod_id].delivered, confirmation->tons);
+      __sync_fetch_and_sub(&all_products_stats[confirmation->prod_id].on_ship, confirmation->tons);
+      stats_update_end(shared_header);
+
+      my_products[prod_ind].ton = my_products[prod_ind].ton - confirmation->tons;
+      if(confirmation->tons != requested) {
+         give_reservable(&my_products[prod_ind].reservable, requested - confirmation->tons);
       }
    }
 
-   sigprocmask(SIG_UNBLOCK, &my_mask, NULL);
+   pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
    /* 
     * End of communications, procedure ended successfully
     */
 
-   confirmation.mtype = (long) confirmation.sender;
+   confirmation->mtype = (long) confirmation->sender;
 
-   while(msgsnd(ports_infos[my_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), 0) == -1);
+   while(ipc_msgsnd(ports_infos[my_index].msg_queue_id, confirmation, sizeof(struct my_ackbuf) - sizeof(long), 0) == -1);
+}
 
-   return 1;
+/*
+ * This method handles the start of a new day: the expired lots are removed and, 
+ * if it is time, new offer and demand are generated
+ */
+void new_day() {
+   check_expired_products();
+   if(so_gen_period > 0 && current_day % so_gen_period == 0) {
+      generate_products();
+   }
+}
+
+/*
+ * This method hosts all the ports in this process (server mode, see SO_PORT_THREADS). The ports 
+ * share a message queue, the messages are handled by a pool of threads (see port_server_worker),
+ * while this thread handles the signals: the threads are created with the signals blocked, so
+ * that the days are handled here, one port at a time, holding the mutex of the port
+ */
+void run_port_server() {
+   int i, sig, threads = shared_header->config.SO_PORT_THREADS;
+   pthread_t *workers;
+   sigset_t my_mask;
+
+   sigemptyset(&my_mask);
+   sigaddset(&my_mask, SIGUSR1);
+   sigaddset(&my_mask, SIGUSR2);
+   sigaddset(&my_mask, SIGINT);
+   sigaddset(&my_mask, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &my_mask, NULL);
+
+   server_queue_id = msgget(IPC_PRIVATE, 0666);
+   server_states = malloc(so_porti * sizeof(struct port_server_state));
+   for(i=0; i<so_porti; i++) {
+      port_register(server_queue_id);
+      create_products();
+      pthread_mutex_init(&server_states[my_index].lock, NULL);
+      server_states[my_index].busy = 0;
+      server_states[my_index].first_pending = NULL;
+      server_states[my_index].last_pending = NULL;
+   }
+
+   notify_master_for_synch(so_porti);
+
+   wait_simulation_start(so_porti);
+
+   workers = malloc(threads * sizeof(pthread_t));
+   for(i=0; i<threads; i++) {
+      pthread_create(&workers[i], NULL, port_server_worker, NULL);
+   }
+
+   while(sigwait(&my_mask, &sig) == 0 && sig == SIGUSR2) {
+      current_day++;
+      for(i=0; i<so_porti; i++) {
+         pthread_mutex_lock(&server_states[i].lock);
+         load_port(i);
+         new_day();
+         pthread_mutex_unlock(&server_states[i].lock);
+      }
+   }
+
+   /* The simulation ended: the threads are terminated by exit */
+   port_local_free();
+   exit(EXIT_SUCCESS);
+}
+
+/*
+ * This method is executed by the threads of the server: each message is handled holding the mutex 
+ * of its port. A request that arrives while the port is waiting for a confirmation is kept
+ * until the end of the exchange, as it would stay in the queue of the port in process mode
+ */
+void *port_server_worker(void *arg) {
+   struct my_msgbuf msg;
+   struct my_ackbuf confirmation;
+   struct port_server_state *state;
+   struct pending_request *pending;
+
+   while(1) {
+      /* Both the requests (mtype 1) and the confirmations (mtype 100) */
+      while(ipc_msgrcv(server_queue_id, &msg, sizeof(struct my_msgbuf) - sizeof(long), -100, 0) == -1);
+
+      state = &server_states[msg.port];
+      pthread_mutex_lock(&state->lock);
+      load_port(msg.port);
+
+      if(msg.mtype == 100) {
+         memcpy(&confirmation, &msg, sizeof(confirmation));
+         serve_confirmation(&confirmation, state->prod_ind, state->requested);
+         state->busy = 0;
+         while(!state->busy && (pending = state->first_pending) != NULL) {
+            state->first_pending = pending->next;
+            if(state->first_pending == NULL) {
+               state->last_pending = NULL;
+            }
+            start_exchange(state, &pending->request);
+            free(pending);
+         }
+      } else if(state->busy) {
+         pending = malloc(sizeof(struct pending_request));
+         pending->request = msg;
+         pending->next = NULL;
+         if(state->last_pending == NULL) {
+            state->first_pending = pending;
+         } else {
+            state->last_pending->next = pending;
+         }
+         state->last_pending = pending;
+      } else {
+         start_exchange(state, &msg);
+      }
+
+      pthread_mutex_unlock(&state->lock);
+   }
+
+   return NULL;
+}
+
+/*
+ * This method loads the given port in the thread-local variables of the thread
+ */
+void load_port(int port) {
+   my_index = port;
+   my_products = catalogue + port * catalogue_stride;
+   my_products_count = ports_infos[port].products_count;
+   my_random = &ports_random[port];
+}
+
+/*
+ * This method replies to a request for the loaded port and, if the request is idoneus,
+ * marks the port as busy until the confirmation of the ship
+ */
+void start_exchange(struct port_server_state *state, struct my_msgbuf *request) {
+   state->prod_ind = serve_request(request);
+   state->requested = request->tons;
+   state->busy = (state->prod_ind != -1);
 }
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "executor.h"
 
 /* Env vars:
  * 
@@ -13,6 +14,7 @@
  * 8) ship_stats_shm_id
  * 9) ports_stats_shm_id
  * 10) products_stats_shm_id
+ * 11) header_shm_id
  */
 extern char **environ;
 
@@ -21,25 +23,53 @@ extern char **environ;
 struct ship_info my_infos;
 struct port_info *ports_infos;
 
-/* This array represents the list of products currently loaded on the ship */
+/*
+ * The catalogues of the ports and the lists of the catalogue elements of each product,
+ * in shared memory (see struct shared_header)
+ */
+struct product *catalogue;
+int *product_index;
+int catalogue_stride;
+
+/* 
+ * This array represents the list of products currently loaded on the ship: as for the offer 
+ * of the ports, each product is made of one or more lots (see struct cargo_lot) ordered by product_life
+ */
 struct product *current_cargo;
 
+/*
+ * The lots on board and the list of the free ones. The array grows when all the lots are used
+ */
+struct cargo_lot *cargo_lots;
+int cargo_lots_size, free_cargo_lot = -1;
+
+/*
+ * The products on board are kept in a min-heap ordered by the product_life of their first lot, 
+ * so that the most urgent lot on board is always the first lot of cargo_heap[0]. 
+ * heap_position contains the position of each product in the heap (-1 if not on board), while
+ * cargo_visit is used to visit the products from the most to the less urgent without modifying the heap
+ */
+int *cargo_heap, *heap_position, *cargo_visit;
+int cargo_heap_size = 0;
+
 /*
  * These arrays contain, respectively, the indexes of: 
  *    - the ports in shared memory
- *    - the products offered by the destination port
- *    - the products currently loaded on the ship
+ *    - the elements of the catalogue of a port that are currently offered
  * These arrays are used during the merge sort 
  */
 
 int *sorted_ports;
 int *sorted_products;
-int *sorted_cargo;
 
-int shm_id, sem_id, ship_stats_shm_id, ports_stats_shm_id, prod_stats_shm_id;
+/* This array contains the cost (in days) of a trip to each port, used to sort the ports */
+float *ports_cost;
+
+int shm_id, sem_id, ship_stats_shm_id, ports_stats_shm_id, prod_stats_shm_id, header_shm_id;
 int current_status = 0; /* 0 -> Empty, 1 -> Loaded, 2 -> In port*/
-int so_porti, so_capacity, so_merci;
-int port_dest_index = -1, current_day=0, load_counter=0, current_capacity;
+int so_porti, so_capacity, so_merci, so_banchine;
+int port_dest_index = -1, current_day=0, my_index;
+long current_capacity;
 float so_speed, so_lato, so_loadspeed;
 
 /* 
@@ -54,35 +84,131 @@ struct port_stats *all_ports_stats;
 
 struct prod_stats *all_products_stats;
 
+struct shared_header *shared_header;
+
+/* The trace rings in shared memory, NULL if the events are not traced (see struct trace_ring) */
+struct trace_ring *trace_rings = NULL;
+
+/* Times of the quays of each port, recorded by the ships (see struct quay_stats) */
+struct quay_stats *quay_stats;
+
+/* How each ship spent the simulation, in shared memory (see struct ship_usage) */
+struct ship_usage *ships_usage;
+
+/* 
+ * The lanes of the tons delivered by the ships of this process, a hash table with linear probing: 
+ * it's added to the shared pool of the lanes when it's almost full and at the end (see flush_lanes)
+ */
+struct lane *lanes_table, *lanes_pool;
+int lanes_used = 0;
+
+/*
+ * The quays calendar in shared memory (see struct shared_header) and the
+ * infos about the booking made by the ship before leaving for the destination:
+ * the index of the booked quay (-1 if none) and the instant in which the booking ends
+ */
+double *quays_calendar;
+int booked_quay = -1;
+double booked_end;
+
+/* Admission queues of the ports and slots of the ships, in shared memory */
+struct quays_queue *quays_queues;
+struct ship_slot *ship_slots;
+
+/*
+ * The type of the messages that the ports send to this ship: the pid of the ship, or
+ * INT_MAX - my_index when the process hosts many ships (a pid is never that big)
+ */
+int ship_mtype;
+
+/*
+ * Executor mode: the number of processes hosting the ships (0 if every ship is a process),
+ * the flag used for the IPC operations that might block, the number of days that ended and
+ * that weren't yet handled by the executor.
+ * The state of each ship hosted by the process is saved here when the ship suspends itself 
+ * (see struct ship_state), and loaded into the globals above when the ship is resumed
+ */
+int executors = 0, ipc_wait_flag = 0, hosted_ships = 0;
+volatile int pending_days = 0;
+
+struct ship_state {
+   struct ship_info my_infos;
+   struct product *current_cargo;
+   struct cargo_lot *cargo_lots;
+   int cargo_lots_size, free_cargo_lot;
+   int *cargo_heap, *heap_position, *cargo_visit;
+   int cargo_heap_size;
+   int *sorted_ports, *sorted_products;
+   float *ports_cost;
+   int current_status, port_dest_index, my_index;
+   long current_capacity;
+   int booked_quay;
+   double booked_end;
+   int ship_mtype;
+};
+
+struct ship_state *ships_states;
+
 /* Methods */
 
 void ship_config();
 void ship_malloc_and_shm();
-void notify_master_for_synch();
+void ship_malloc();
+void ship_register(int);
+void notify_master_for_synch(int);
+void wait_simulation_start(int);
 void ship_local_free();
 
+void run_executor();
+void ship_task();
+void save_ship_state(int);
+void load_ship_state(int);
+void ship_between();
+int ship_yield(int);
+
 float get_distance(float, float);
-int compare_by_distance(int, int);
+void evaluate_ports_cost();
+int compare_by_cost(int, int);
 void ports_merge(int, int, int);
 void ports_merge_sort(int, int);
 
-int compare_by_expirance(int, int, int);
-void products_merge(int, int, int, int);
-void products_merge_sort(int, int, int);
-
-void access_leave_port(int);
+int port_offers(int);
+int compare_by_expirance(int, int);
+void products_merge(int, int, int);
+void products_merge_sort(int, int);
+
+int cargo_lot_alloc();
+void cargo_heap_swap(int *, int, int);
+void cargo_heap_up(int *, int);
+void cargo_heap_down(int *, int, int);
+void update_cargo_heap(int);
+void add_cargo_lot(int, long, int);
+void remove_cargo_tons(int, long, int);
+void credit_lane(int, int, long, double);
+void flush_lanes();
+
+void access_leave_port(int, int);
+int next_admitted_ship();
+double get_sim_time();
+void lock_calendar(int, int);
+double earliest_quay_slot(int, double, int *);
+void book_quay(double, double);
+void release_quay_booking();
+int plan_trip(double, struct trip_plan *);
 int navigate();
 int *demanding_ports(int);
-int reserve_product(int, int);
-int load_unload_product(int, int, int);
+long reserve_product(int, int);
+int load_unload_product(int, long, int);
 
 void check_expiring_products();
+void ship_trace(int, int, int, long);
 
-void my_sleep(time_t, long);
+void my_sleep(time_t, long, int);
 
+/* The microbenchmarks link the methods of the ship without its main (see microbench.c) */
+#ifndef MICROBENCH
 int main(int argc, char const *argv[]) {
    struct sigaction sa;
-   struct sembuf start;
    int i, j;
 
    bzero(&sa, sizeof(sa));
@@ -90,25 +216,37 @@ int main(int argc, char const *argv[]) {
    sigaction(SIGUSR1, &sa, NULL);
    sigaction(SIGUSR2, &sa, NULL);
 
-   srand(getpid());
-
    ship_config();
 
    ship_malloc_and_shm();
 
-   notify_master_for_synch();
+   /* 
+    * In zygote mode this process was the only ship started by the master:
+    * every other ship (or executor) is forked from here, inheriting the setup done so far 
+    */
+   if(shared_header->config.SO_ZYGOTE) {
+      spawn_processes((executors > 0) ? executors : shared_header->config.SO_NAVI);
+   }
 
-   start.sem_num = 2;
-   start.sem_op = -1;
-   start.sem_flg = 0;
+   if(executors > 0) {
+      run_executor();
+      return 0;
+   }
+
+   ship_malloc();
+
+   ship_register(-1);
+
+   notify_master_for_synch(1);
 
-   semop(sem_id, &start, 1);
+   wait_simulation_start(1);
 
    while(navigate());
    
    ship_local_free();
    return 0;
 }
+#endif
 
 void handle_signal(int signum) {
    int i;
@@ -119,7 +257,11 @@ void handle_signal(int signum) {
          break;
       case SIGUSR2:
          current_day++;
-         check_expiring_products();
+         if(executors > 0) { /* The hosted ships are checked by ship_between */
+            pending_days++;
+         } else {
+            check_expiring_products();
+         }
          break;
       case SIGINT:
          ship_local_free();
@@ -135,7 +277,7 @@ void handle_signal(int signum) {
 }
 
 /*
- * This method initializes the configuration variables and the coordinates of the ship
+ * This method initializes the configuration variables of the ship
  */
 void ship_config() {
    shm_id = atoi(environ[0]);
@@ -145,90 +287,341 @@ void ship_config() {
    so_lato = atof(environ[4]);
    so_speed = atof(environ[5]);
    so_capacity = atoi(environ[6]);
-   current_capacity = so_capacity;
    so_loadspeed = atof(environ[7]);
    ship_stats_shm_id = atoi(environ[8]);
    ports_stats_shm_id = atoi(environ[9]);
    prod_stats_shm_id = atoi(environ[10]);
-
-   my_infos.coord_x = (float)rand() / RAND_MAX * so_lato;
-   my_infos.coord_y = (float)rand() / RAND_MAX * so_lato;
+   header_shm_id = atoi(environ[11]);
 }
 
+/*
+ * This method attaches the shared memory: in zygote mode it is executed only once 
+ * and its results are shared by all the ships
+ */
 void ship_malloc_and_shm() {
    int i;
 
-   ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
+   ports_infos = (struct port_info *)ipc_shmat(shm_id, NULL, 0);
    if(ports_infos == (struct port_info *)-1) {
       printf("Error during shmat in ship.c\n");
       perror("shmat");
    }
 
-   for(i=0; i<so_porti; i++) {
-      ports_infos[i].my_products_offer = (struct product *) shmat(ports_infos[i].off_shm_id, NULL, 0);
-      ports_infos[i].my_products_demand = (struct product *) shmat(ports_infos[i].dem_shm_id, NULL, 0);
+   shared_header = (struct shared_header *)ipc_shmat(header_shm_id, NULL, 0);
+   catalogue = (struct product *)ipc_shmat(shared_header->catalogue_shm_id, NULL, 0);
+   product_index = (int *)ipc_shmat(shared_header->product_index_shm_id, NULL, 0);
+   catalogue_stride = shared_header->catalogue_stride;
+
+   executors = shared_header->config.SO_EXECUTORS;
+   ipc_wait_flag = (executors > 0) ? IPC_NOWAIT : 0;
+
+   all_ships_stats = (int *)ipc_shmat(ship_stats_shm_id, NULL, 0);
+
+   all_ports_stats = (struct port_stats *)ipc_shmat(ports_stats_shm_id, NULL, 0);
+   all_products_stats = (struct prod_stats *)ipc_shmat(prod_stats_shm_id, NULL, 0);
+
+   so_banchine = shared_header->config.SO_BANCHINE;
+   quays_calendar = (double *)ipc_shmat(shared_header->calendar_shm_id, NULL, 0);
+
+   quays_queues = (struct quays_queue *)ipc_shmat(shared_header->queues_shm_id, NULL, 0);
+   ship_slots = (struct ship_slot *)ipc_shmat(shared_header->ship_slots_shm_id, NULL, 0);
+
+   quay_stats = (struct quay_stats *)ipc_shmat(shared_header->quay_stats_shm_id, NULL, 0);
+   ships_usage = (struct ship_usage *)ipc_shmat(shared_header->ship_usage_shm_id, NULL, 0);
+   lanes_pool = (struct lane *)ipc_shmat(shared_header->lanes_shm_id, NULL, 0);
+   lanes_table = malloc(LANE_TABLE_SIZE * sizeof(struct lane));
+   for(i=0; i<LANE_TABLE_SIZE; i++) {
+      lanes_table[i].origin = -1;
    }
 
+   if(shared_header->trace_shm_id != -1) {
+      trace_rings = (struct trace_ring *)ipc_shmat(shared_header->trace_shm_id, NULL, 0);
+   }
+}
+
+/*
+ * This method allocates the local structures of a ship
+ */
+void ship_malloc() {
+   int i;
+
    current_cargo = malloc(so_merci * sizeof(struct product));
-   sorted_products = malloc(so_merci * sizeof(int));
-   sorted_cargo = malloc(so_merci * sizeof(int));
+   sorted_products = malloc(catalogue_stride * sizeof(int));
+   cargo_heap = malloc(so_merci * sizeof(int));
+   heap_position = malloc(so_merci * sizeof(int));
+   cargo_visit = malloc(so_merci * sizeof(int));
    for(i=0; i<so_merci; i++) {
       current_cargo[i].product_id = i;
-      sorted_products[i] = i;
-      sorted_cargo[i] = i;
+      current_cargo[i].ton = 0;
+      current_cargo[i].product_life = 0;
+      current_cargo[i].status = 0;
+      current_cargo[i].first_lot = -1;
+      heap_position[i] = -1;
+   }
+
+   cargo_lots_size = so_merci;
+   cargo_lots = malloc(cargo_lots_size * sizeof(struct cargo_lot));
+   for(i=0; i<cargo_lots_size; i++) {
+      cargo_lots[i].next = (i+1 < cargo_lots_size) ? i+1 : -1;
    }
+   free_cargo_lot = 0;
    
 
    sorted_ports = malloc(so_porti * sizeof(int));
+   ports_cost = malloc(so_porti * sizeof(float));
    for(i=0; i<so_porti; i++) {
       sorted_ports[i] = i;
    }
+}
 
-   all_ships_stats = (int *)shmat(ship_stats_shm_id, NULL, 0);
-   all_ships_stats[0]++;
+/*
+ * This method sets up the infos of this ship: its coordinates, its index (taken from the 
+ * counter in the shared header if "index" is -1) and its slot, where the master finds its pid
+ */
+void ship_register(int index) {
+   struct random_state ship_random;
+
+   __sync_fetch_and_add(&all_ships_stats[0], 1);
    current_status = 0;
+   current_capacity = so_capacity;
+   port_dest_index = -1;
+   booked_quay = -1;
 
-   all_ports_stats = (struct port_stats *)shmat(ports_stats_shm_id, NULL, 0);
-   all_products_stats = (struct prod_stats *)shmat(prod_stats_shm_id, NULL, 0);
+   if(index == -1) {
+      my_index = __sync_fetch_and_add(&shared_header->ships_count, 1);
+   } else {
+      my_index = index;
+   }
+   ship_mtype = (executors > 0) ? INT_MAX - my_index : getpid();
+   ship_slots[my_index].ship_pid = getpid();
+   ship_slots[my_index].next = -1;
+
+   random_seed(&ship_random, shared_header->config.SO_SEED, IPC_ROLE_SHIP, my_index);
+   my_infos.coord_x = random_unit(&ship_random) * so_lato;
+   my_infos.coord_y = random_unit(&ship_random) * so_lato;
 }
 
 /*
  * This method is used to notify the master and let him know that
- * my setup phase is complete and that I'm ready to start
+ * the setup phase of the given number of ships is complete and that they are ready to start
  */
-void notify_master_for_synch() {
+void notify_master_for_synch(int ships) {
    struct sembuf my_synch;
 
    my_synch.sem_num = 1;
-   my_synch.sem_op = -1;
+   my_synch.sem_op = -ships;
    my_synch.sem_flg = 0;
 
-   semop(sem_id, &my_synch, 1);
+   ipc_semop(sem_id, &my_synch, 1);
+}
+
+/*
+ * This method waits for the master to start the simulation
+ */
+void wait_simulation_start(int ships) {
+   struct sembuf start;
+
+   start.sem_num = 2;
+   start.sem_op = -ships;
+   start.sem_flg = 0;
+
+   ipc_semop(sem_id, &start, 1);
 }
 
 void ship_local_free() {
    free(current_cargo);
    free(sorted_ports);
+   free(ports_cost);
    free(sorted_products);
-   free(sorted_cargo);
+   free(cargo_heap);
+   free(heap_position);
+   free(cargo_visit);
+   free(cargo_lots);
+   flush_lanes();
+   ipc_stats_publish(shared_header, IPC_ROLE_SHIP);
 }
 
 /*
- * This method is used to determine which port between
- * 'a' and 'b' is closer to the ship, where 'a' and 'b'
- * are the indexes of the ports
+ * This method hosts a share of the ships in this process: the executors take their share in
+ * order, each one a contiguous range of indexes, so that the ships are spread evenly.
+ * Each ship is a task of the executor (see executor.h) that runs navigate(); every method
+ * of the ship works on the globals, so the state of the ship is loaded into the globals when the 
+ * task is resumed and saved when it suspends itself (in my_sleep or while waiting for an IPC)
+ */
+void run_executor() {
+   int i, k, first_ship, so_navi = shared_header->config.SO_NAVI;
+
+   k = __sync_fetch_and_add(&shared_header->executors_count, 1);
+   first_ship = (int)((long)k * so_navi / executors);
+   hosted_ships = (int)((long)(k + 1) * so_navi / executors) - first_ship;
+
+   ships_states = malloc(hosted_ships * sizeof(struct ship_state));
+   for(i=0; i<hosted_ships; i++) {
+      ship_malloc();
+      ship_register(first_ship + i);
+      save_ship_state(i);
+   }
+   executor_init(hosted_ships, ship_task, load_ship_state, save_ship_state, ship_between);
+
+   notify_master_for_synch(hosted_ships);
+
+   wait_simulation_start(hosted_ships);
+
+   executor_run();
+
+   for(i=0; i<hosted_ships; i++) {
+      load_ship_state(i);
+      ship_local_free();
+   }
+   free(ships_states);
+   executor_free();
+}
+
+/*
+ * This method is the entry point of the tasks of the executor. navigate() returns at once when
+ * the ship has nothing to do: in that case the ship waits before trying again, otherwise
+ * it would never give way to the other ships
+ */
+void ship_task() {
+   int attempts = 0;
+   double start = get_sim_time();
+
+   while(navigate()) {
+      if(get_sim_time() - start < EXECUTOR_POLL_INTERVAL) {
+         ship_yield(attempts++);
+      } else {
+         attempts = 0;
+      }
+      start = get_sim_time();
+   }
+}
+
+void save_ship_state(int ship) {
+   struct ship_state *state = &ships_states[ship];
+
+   state->my_infos = my_infos;
+   state->current_cargo = current_cargo;
+   state->cargo_lots = cargo_lots;
+   state->cargo_lots_size = cargo_lots_size;
+   state->free_cargo_lot = free_cargo_lot;
+   state->cargo_heap = cargo_heap;
+   state->heap_position = heap_position;
+   state->cargo_visit = cargo_visit;
+   state->cargo_heap_size = cargo_heap_size;
+   state->sorted_ports = sorted_ports;
+   state->sorted_products = sorted_products;
+   state->ports_cost = ports_cost;
+   state->current_status = current_status;
+   state->port_dest_index = port_dest_index;
+   state->my_index = my_index;
+   state->current_capacity = current_capacity;
+   state->booked_quay = booked_quay;
+   state->booked_end = booked_end;
+   state->ship_mtype = ship_mtype;
+}
+
+void load_ship_state(int ship) {
+   struct ship_state *state = &ships_states[ship];
+
+   my_infos = state->my_infos;
+   current_cargo = state->current_cargo;
+   cargo_lots = state->cargo_lots;
+   cargo_lots_size = state->cargo_lots_size;
+   free_cargo_lot = state->free_cargo_lot;
+   cargo_heap = state->cargo_heap;
+   heap_position = state->heap_position;
+   cargo_visit = state->cargo_visit;
+   cargo_heap_size = state->cargo_heap_size;
+   sorted_ports = state->sorted_ports;
+   sorted_products = state->sorted_products;
+   ports_cost = state->ports_cost;
+   current_status = state->current_status;
+   port_dest_index = state->port_dest_index;
+   my_index = state->my_index;
+   current_capacity = state->current_capacity;
+   booked_quay = state->booked_quay;
+   booked_end = state->booked_end;
+   ship_mtype = state->ship_mtype;
+}
+
+/*
+ * This method is called by the executor between two tasks: for each day that ended, 
+ * the expired lots are removed from the hold of every hosted ship
+ */
+void ship_between() {
+   sigset_t my_mask;
+   int i;
+
+   sigemptyset(&my_mask);
+   sigaddset(&my_mask, SIGUSR2);
+   sigprocmask(SIG_BLOCK, &my_mask, NULL);
+   while(pending_days > 0) {
+      pending_days--;
+      for(i=0; i<hosted_ships; i++) {
+         load_ship_state(i);
+         check_expiring_products();
+         save_ship_state(i);
+      }
+   }
+   sigprocmask(SIG_UNBLOCK, &my_mask, NULL);
+}
+
+/*
+ * This method is called when an IPC operation done with ipc_wait_flag failed for the given
+ * number of times in a row: in executor mode the ship gives way to the other ships and 
+ * returns 1, so that the operation is tried again later, otherwise it returns 0
  */
-int compare_by_distance(int a, int b) {
-   float distance_a = 0.0, distance_b = 0.0;
+int ship_yield(int attempts) {
+   double interval = EXECUTOR_POLL_INTERVAL;
 
-   ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
+   if(executors > 0) {
+      while(attempts-- > 0 && interval < EXECUTOR_POLL_MAX_INTERVAL) {
+         interval *= 2;
+      }
+      executor_sleep((interval < EXECUTOR_POLL_MAX_INTERVAL) ? interval : EXECUTOR_POLL_MAX_INTERVAL);
+      return 1;
+   }
+   return 0;
+}
+
+/*
+ * This method evaluates the cost of a trip to each port, that is the time needed to reach
+ * the port plus the time the ship expects to wait for a quay. The waiting time is the
+ * greater between the one given by the quays calendar and the one estimated from the load 
+ * published by the port: every ship that is in port, waiting for a quay or sailing to the
+ * port beyond the number of quays is expected to keep a quay busy for half of the time 
+ * needed to fill a ship
+ */
+void evaluate_ports_cost() {
+   int i, ahead;
+   double eta, now = get_sim_time(), wait, congestion_wait;
+
+   for(i=0; i<so_porti; i++) {
+      eta = get_distance(ports_infos[i].coord_x, ports_infos[i].coord_y) / so_speed;
+      wait = earliest_quay_slot(i, now + eta, NULL) - (now + eta);
+
+      ahead = all_ports_stats[i].occupied_quays + quays_queues[i].waiting + quays_queues[i].inbound;
+      if(ahead >= all_ports_stats[i].total_quays && all_ports_stats[i].total_quays > 0) {
+         congestion_wait = (double)(ahead - all_ports_stats[i].total_quays + 1) / 
+            all_ports_stats[i].total_quays * (so_capacity / (2 * so_loadspeed));
+         if(congestion_wait > wait) {
+            wait = congestion_wait;
+         }
+      }
 
-   distance_a = get_distance(ports_infos[a].coord_x, ports_infos[a].coord_y);
-   distance_b = get_distance(ports_infos[b].coord_x, ports_infos[b].coord_y);
+      ports_cost[i] = eta + wait;
+   }
+}
 
-   if(distance_a < distance_b) {
+/*
+ * This method is used to determine which port between
+ * 'a' and 'b' is cheaper to reach for the ship, where 'a' and 'b'
+ * are the indexes of the ports
+ */
+int compare_by_cost(int a, int b) {
+   if(ports_cost[a] < ports_cost[b]) {
       return -1;
-   } else if(distance_a > distance_b) {
+   } else if(ports_cost[a] > ports_cost[b]) {
       return 1;
    } else {
       return 0;
@@ -246,7 +639,7 @@ float get_distance(float coord_x, float coord_y) {
 
 /*
  * Implementation of the merge sort used to sort the ports
- * from closest to farthest to the ship 
+ * from cheapest to most expensive to reach for the ship (see evaluate_ports_cost)
  */
 void ports_merge(int left, int mid, int right) {
    int n1 = mid - left + 1, n2 = right - mid, i, j, k;
@@ -265,7 +658,7 @@ void ports_merge(int left, int mid, int right) {
    k = left;
 
    while (i < n1 && j < n2) {
-      if (compare_by_distance(leftArray[i], rightArray[j]) <= 0) {
+      if (compare_by_cost(leftArray[i], rightArray[j]) <= 0) {
          sorted_ports[k] = leftArray[i];
          i++;
       } else {
@@ -293,7 +686,7 @@ void ports_merge(int left, int mid, int right) {
 
 /*
  * Implementation of the merge sort used to sort the ports
- * from closest to farthest to the ship 
+ * from cheapest to most expensive to reach for the ship (see evaluate_ports_cost)
  */
 void ports_merge_sort(int left, int right) {
    int mid;
@@ -306,68 +699,52 @@ void ports_merge_sort(int left, int right) {
    }
 }
 
+/*
+ * This method puts in sorted_products the elements of the catalogue of the given port 
+ * that are currently offered and returns their number
+ */
+int port_offers(int port) {
+   int i, count = 0, first = port * catalogue_stride;
+
+   for(i=first; i<first + ports_infos[port].products_count; i++) {
+      if(catalogue[i].type == 0 && catalogue[i].ton > 0) {
+         sorted_products[count++] = i;
+      }
+   }
+
+   return count;
+}
+
 /*
  * This method is used to determine which product between 'a' and 'b' expires sooner, 
  * therefore the method determines which product is the most urgent. 
- * The parameters 'a' and 'b' are the indexes of the products.
- * The parameter port_id can assume different values:
- *    - if it equals -1 then it means that the products that the method has to
- *      compare are loaded on the ship
- *    - otherwise the index must be used to access the port infos in shared memory
- *      and examine the port offer
- */
-int compare_by_expirance(int port_id, int prod_a, int prod_b) {
-   if(port_id != -1) {
-      ports_infos[port_id].my_products_offer = (struct product *)shmat(ports_infos[port_id].off_shm_id, NULL, 0);
-      if(ports_infos[port_id].my_products_offer[prod_a].product_life < ports_infos[port_id].my_products_offer[prod_b].product_life) {
-         return -1;
-      } else if(ports_infos[port_id].my_products_offer[prod_a].product_life > ports_infos[port_id].my_products_offer[prod_b].product_life) {
-         return 1;
-      } else {
-         return 0;
-      }
+ * The parameters 'a' and 'b' are the indexes of the products in the catalogue.
+ */
+int compare_by_expirance(int prod_a, int prod_b) {
+   if(catalogue[prod_a].product_life < catalogue[prod_b].product_life) {
+      return -1;
+   } else if(catalogue[prod_a].product_life > catalogue[prod_b].product_life) {
+      return 1;
    } else {
-      if(current_cargo[prod_a].product_life < current_cargo[prod_b].product_life) {
-         return -1;
-      } else if(current_cargo[prod_a].product_life > current_cargo[prod_b].product_life) {
-         return 1;
-      } else {
-         return 0;
-      }
+      return 0;
    }
 }
 
 /*
- * Implementation of the merge sort used to sort the products from most to less urgent.
- * The parameter port_id can assume different values:
- *    - if it equals -1 then it means that the method has to sort the product 
- *      loaded on the ship
- *    - otherwise the index must be used to access the port infos in shared memory
- *      and sort the port offer
+ * Implementation of the merge sort used to sort the products offered by a port 
+ * (see port_offers) from most to less urgent.
  */
-void products_merge(int port_id, int left, int mid, int right) {
+void products_merge(int left, int mid, int right) {
    int n1 = mid - left + 1, n2 = right - mid, i, j, k;
    int *leftArray = (int *)malloc(n1 * sizeof(int));
    int *rightArray = (int *)malloc(n2 * sizeof(int));
 
-   if(port_id != -1) {
-      for (i=0; i<n1; i++) {
-         leftArray[i] = sorted_products[left + i];
-      }
-   } else {
-      for (i=0; i<n1; i++) {
-         leftArray[i] = sorted_cargo[left + i];
-      }
+   for (i=0; i<n1; i++) {
+      leftArray[i] = sorted_products[left + i];
    }
    
-   if(port_id != -1) {
-      for (i = 0; i < n2; i++) {
-         rightArray[i] = sorted_products[mid + 1 + i];
-      }
-   } else {
-      for (i = 0; i < n2; i++) {
-         rightArray[i] = sorted_cargo[mid + 1 + i];
-      }
+   for (i = 0; i < n2; i++) {
+      rightArray[i] = sorted_products[mid + 1 + i];
    }
       
    i = 0;
@@ -375,40 +752,24 @@ void products_merge(int port_id, int left, int mid, int right) {
    k = left;
 
    while (i < n1 && j < n2) {
-      if (compare_by_expirance(port_id, leftArray[i], rightArray[j]) <= 0) {
-         if(port_id != -1) {
-            sorted_products[k] = leftArray[i];
-         } else {
-            sorted_cargo[k] = leftArray[i];
-         }
+      if (compare_by_expirance(leftArray[i], rightArray[j]) <= 0) {
+         sorted_products[k] = leftArray[i];
          i++;
       } else {
-         if(port_id != -1) {
-            sorted_products[k] = rightArray[j];
-         } else {
-            sorted_cargo[k] = rightArray[j];
-         }
+         sorted_products[k] = rightArray[j];
          j++;
       }
       k++;
    }
 
    while (i < n1) {
-      if(port_id != -1) {
-         sorted_products[k] = leftArray[i];
-      } else {
-         sorted_cargo[k] = leftArray[i];
-      }
+      sorted_products[k] = leftArray[i];
       i++;
       k++;
    }
 
    while (j < n2) {
-      if(port_id != -1) {
-         sorted_products[k] = rightArray[j];
-      } else {
-         sorted_cargo[k] = rightArray[j];
-      }
+      sorted_products[k] = rightArray[j];
       j++;
       k++;
    }
@@ -418,21 +779,229 @@ void products_merge(int port_id, int left, int mid, int right) {
 }
 
 /*
- * Implementation of the merge sort used to sort the products from most to less urgent.
- * The parameter port_id can assume different values:
- *    - if it equals -1 then it means that the method has to sort the product 
- *      loaded on the ship
- *    - otherwise the index must be used to access the port infos in shared memory
- *      and sort the port offer
+ * Implementation of the merge sort used to sort the products offered by a port 
+ * (see port_offers) from most to less urgent.
  */
-void products_merge_sort(int port_id, int left, int right) {
+void products_merge_sort(int left, int right) {
    int mid;
 
    if(left < right) {
       mid = left + (right - left) / 2;
-      products_merge_sort(port_id, left, mid); 
-      products_merge_sort(port_id, mid+1, right);
-      products_merge(port_id, left, mid, right);
+      products_merge_sort(left, mid); 
+      products_merge_sort(mid+1, right);
+      products_merge(left, mid, right);
+   }
+}
+
+/*
+ * This method returns the index of a free lot of the hold, doubling the size of the
+ * hold when all the lots are used. It must be called with SIGUSR2 blocked, since 
+ * the signal handler accesses the lots
+ */
+int cargo_lot_alloc() {
+   int i, old_size;
+
+   if(free_cargo_lot == -1) {
+      old_size = cargo_lots_size;
+      cargo_lots_size *= 2;
+      cargo_lots = realloc(cargo_lots, cargo_lots_size * sizeof(struct cargo_lot));
+      for(i=old_size; i<cargo_lots_size; i++) {
+         cargo_lots[i].next = (i+1 < cargo_lots_size) ? i+1 : -1;
+      }
+      free_cargo_lot = old_size;
+   }
+   i = free_cargo_lot;
+   free_cargo_lot = cargo_lots[i].next;
+
+   return i;
+}
+
+/*
+ * These methods handle a min-heap of products ordered by the product_life of the products on board.
+ * They work both on cargo_heap, keeping heap_position updated, and on cargo_visit
+ */
+void cargo_heap_swap(int *heap, int a, int b) {
+   int tmp = heap[a];
+
+   heap[a] = heap[b];
+   heap[b] = tmp;
+   if(heap == cargo_heap) {
+      heap_position[heap[a]] = a;
+      heap_position[heap[b]] = b;
+   }
+}
+
+void cargo_heap_up(int *heap, int pos) {
+   int parent;
+
+   while(pos > 0) {
+      parent = (pos - 1) / 2;
+      if(current_cargo[heap[pos]].product_life >= current_cargo[heap[parent]].product_life) {
+         break;
+      }
+      cargo_heap_swap(heap, pos, parent);
+      pos = parent;
+   }
+}
+
+void cargo_heap_down(int *heap, int size, int pos) {
+   int child;
+
+   while((child = 2 * pos + 1) < size) {
+      if(child + 1 < size && current_cargo[heap[child + 1]].product_life < current_cargo[heap[child]].product_life) {
+         child++;
+      }
+      if(current_cargo[heap[pos]].product_life <= current_cargo[heap[child]].product_life) {
+         break;
+      }
+      cargo_heap_swap(heap, pos, child);
+      pos = child;
+   }
+}
+
+/*
+ * This method restores the position of the given product in cargo_heap after its lots 
+ * changed: the product is inserted, moved or removed if it has no lots left
+ */
+void update_cargo_heap(int prod) {
+   int pos = heap_position[prod], moved;
+
+   if(current_cargo[prod].first_lot == -1) {
+      if(pos != -1) {
+         heap_position[prod] = -1;
+         cargo_heap_size--;
+         if(pos != cargo_heap_size) {
+            moved = cargo_heap[cargo_heap_size];
+            cargo_heap[pos] = moved;
+            heap_position[moved] = pos;
+            cargo_heap_up(cargo_heap, pos);
+            cargo_heap_down(cargo_heap, cargo_heap_size, heap_position[moved]);
+         }
+      }
+   } else if(pos == -1) {
+      cargo_heap[cargo_heap_size] = prod;
+      heap_position[prod] = cargo_heap_size;
+      cargo_heap_size++;
+      cargo_heap_up(cargo_heap, cargo_heap_size - 1);
+   } else {
+      cargo_heap_up(cargo_heap, pos);
+      cargo_heap_down(cargo_heap, cargo_heap_size, heap_position[prod]);
+   }
+}
+
+/*
+ * This method loads a new lot of the given product on board, keeping the lots of the 
+ * product ordered by product_life. It must be called with SIGUSR2 blocked
+ */
+void add_cargo_lot(int prod, long tons, int life) {
+   int lot, prev = -1, curr;
+
+   lot = cargo_lot_alloc();
+   cargo_lots[lot].ton = tons;
+   cargo_lots[lot].product_life = life;
+   cargo_lots[lot].origin = port_dest_index;
+   cargo_lots[lot].loaded_at = get_sim_time();
+
+   curr = current_cargo[prod].first_lot;
+   while(curr != -1 && cargo_lots[curr].product_life <= life) {
+      prev = curr;
+      curr = cargo_lots[curr].next;
+   }
+   cargo_lots[lot].next = curr;
+   if(prev == -1) {
+      current_cargo[prod].first_lot = lot;
+   } else {
+      cargo_lots[prev].next = lot;
+   }
+
+   current_cargo[prod].ton += tons;
+   current_cargo[prod].product_life = cargo_lots[current_cargo[prod].first_lot].product_life;
+   current_cargo[prod].status = 2;
+   update_cargo_heap(prod);
+}
+
+/*
+ * This method removes the given tons of a product from the hold, starting from the
+ * lots that expire first: if they were "delivered" to the destination port, their lanes
+ * are credited. It must be called with SIGUSR2 blocked
+ */
+void remove_cargo_tons(int prod, long tons, int delivered) {
+   int lot;
+   long quantity;
+   double now = get_sim_time();
+
+   while(tons > 0 && (lot = current_cargo[prod].first_lot) != -1) {
+      quantity = cargo_lots[lot].ton < tons ? cargo_lots[lot].ton : tons;
+      if(delivered) {
+         credit_lane(cargo_lots[lot].origin, port_dest_index, quantity, now - cargo_lots[lot].loaded_at);
+      }
+      cargo_lots[lot].ton -= quantity;
+      current_cargo[prod].ton -= quantity;
+      tons -= quantity;
+      if(cargo_lots[lot].ton == 0) {
+         current_cargo[prod].first_lot = cargo_lots[lot].next;
+         cargo_lots[lot].next = free_cargo_lot;
+         free_cargo_lot = lot;
+      }
+   }
+
+   if(current_cargo[prod].first_lot == -1) {
+      current_cargo[prod].ton = 0;
+      current_cargo[prod].product_life = 0;
+      current_cargo[prod].status = 0;
+   } else {
+      current_cargo[prod].product_life = cargo_lots[current_cargo[prod].first_lot].product_life;
+   }
+   update_cargo_heap(prod);
+}
+
+/*
+ * This method adds the given delivery to its lane in the table of this process,
+ * the table is added to the shared pool when it's almost full
+ */
+void credit_lane(int origin, int destination, long tons, double transit) {
+   unsigned int i = (unsigned int)(origin * so_porti + destination) * 2654435761u;
+
+   for(i &= LANE_TABLE_SIZE - 1; lanes_table[i].origin != -1; i = (i + 1) & (LANE_TABLE_SIZE - 1)) {
+      if(lanes_table[i].origin == origin && lanes_table[i].destination == destination) {
+         break;
+      }
+   }
+   if(lanes_table[i].origin == -1) {
+      lanes_table[i].origin = origin;
+      lanes_table[i].destination = destination;
+      lanes_table[i].tons = 0;
+      lanes_table[i].voyages = 0;
+      lanes_table[i].transit = 0;
+      lanes_used++;
+   }
+   lanes_table[i].tons += tons;
+   lanes_table[i].voyages++;
+   lanes_table[i].transit += transit;
+
+   if(lanes_used >= LANE_TABLE_FLUSH) {
+      flush_lanes();
+   }
+}
+
+/*
+ * This method adds the lanes of this process to the shared pool, where the master merges them.
+ * The tons of the lanes that don't fit in the pool are counted as lost
+ */
+void flush_lanes() {
+   int i, slot;
+
+   for(i=0; i<LANE_TABLE_SIZE && lanes_used > 0; i++) {
+      if(lanes_table[i].origin != -1) {
+         slot = __sync_fetch_and_add(&shared_header->lanes_count, 1);
+         if(slot < shared_header->lanes_size) {
+            lanes_pool[slot] = lanes_table[i];
+         } else {
+            __sync_fetch_and_add(&shared_header->lanes_lost, lanes_table[i].tons);
+         }
+         lanes_table[i].origin = -1;
+         lanes_used--;
+      }
    }
 }
 
@@ -441,121 +1010,253 @@ void products_merge_sort(int port_id, int left, int right) {
  * The "action" parameter determines the behaviour of the method:
  *    - if "action" equals "-1", the ship is trying to access the port
  *    - if "action" equals "1", the ship is trying to leave the port
+ * If there are no free quays, the ship joins the admission queue of the port with the given
+ * "priority" (the product_life of the most urgent lot of the planned exchange) and waits on 
+ * its own semaphore: a ship leaving the port doesn't release its quay but hands it over 
+ * directly to the ship chosen by next_admitted_ship()
  */
-void access_leave_port(int action) {
+void access_leave_port(int action, int priority) {
    struct sembuf my_op;
-   int result;  
+   struct quays_queue *queue = &quays_queues[port_dest_index];
+   int result, next, sem_id, attempts = 0;  
 
-   my_op.sem_num = 0;
+   my_op.sem_num = port_dest_index;
    my_op.sem_flg = 0;
+
+   lock_calendar(port_dest_index, -1);
+
+   if(action == -1) {
+      my_op.sem_op = -1;
+      my_op.sem_flg = IPC_NOWAIT;
+      if(queue->waiting == 0 && ipc_semop(shared_header->quays_sem_id, &my_op, 1) == 0) {
+         lock_calendar(port_dest_index, 1);
+         return;
+      }
+      ship_slots[my_index].priority = priority;
+      ship_slots[my_index].bypassed = 0;
+      ship_slots[my_index].next = queue->head;
+      queue->head = my_index;
+      queue->waiting++;
+      lock_calendar(port_dest_index, 1);
+
+      sem_id = ship_semaphore(shared_header, my_index, &my_op);
+      my_op.sem_flg = ipc_wait_flag;
+      do {
+         result = ipc_semop(sem_id, &my_op, 1);
+      } while(result == -1 && (errno == EINTR || ship_yield(attempts++)));
+   } else {
+      if(queue->waiting > 0) {
+         next = next_admitted_ship();
+         sem_id = ship_semaphore(shared_header, next, &my_op);
+         my_op.sem_op = 1;
+         ipc_semop(sem_id, &my_op, 1);
+      } else {
+         my_op.sem_op = 1;
+         ipc_semop(shared_header->quays_sem_id, &my_op, 1);
+      }
+      lock_calendar(port_dest_index, 1);
+   }
+}
+
+/*
+ * This method removes from the admission queue of the destination port the ship 
+ * that will get the quay and returns its index. It must be called holding the lock of the port.
+ * The most urgent ship is chosen, unless a ship has already been overtaken 
+ * QUAY_MAX_BYPASS times: in that case the ship that has been waiting the most is chosen.
+ * Every ship left in the queue is marked as overtaken once more.
+ */
+int next_admitted_ship() {
+   struct quays_queue *queue = &quays_queues[port_dest_index];
+   int curr, prev = -1, best = -1, best_prev = -1, starving = 0;
+
+   for(curr = queue->head; curr != -1; prev = curr, curr = ship_slots[curr].next) {
+      if(best == -1) {
+         best = curr;
+         best_prev = prev;
+         starving = ship_slots[curr].bypassed >= QUAY_MAX_BYPASS;
+      } else if(ship_slots[curr].bypassed >= QUAY_MAX_BYPASS) {
+         if(!starving || ship_slots[curr].bypassed > ship_slots[best].bypassed) {
+            best = curr;
+            best_prev = prev;
+            starving = 1;
+         }
+      } else if(!starving && (ship_slots[curr].priority < ship_slots[best].priority ||
+         (ship_slots[curr].priority == ship_slots[best].priority && ship_slots[curr].bypassed > ship_slots[best].bypassed))) {
+         best = curr;
+         best_prev = prev;
+      }
+   }
+
+   if(best_prev == -1) {
+      queue->head = ship_slots[best].next;
+   } else {
+      ship_slots[best_prev].next = ship_slots[best].next;
+   }
+   ship_slots[best].next = -1;
+   queue->waiting--;
+
+   for(curr = queue->head; curr != -1; curr = ship_slots[curr].next) {
+      ship_slots[curr].bypassed++;
+   }
+
+   return best;
+}
+
+/*
+ * This method returns the current simulated time (in days), including the fractional part
+ */
+double get_sim_time() {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec - shared_header->sim_start.tv_sec) + 
+      (now.tv_nsec - shared_header->sim_start.tv_nsec) / 1e9;
+}
+
+/*
+ * This method is used to lock or unlock the quays calendar of the given port.
+ * The "action" parameter works as in access_leave_port: "-1" to lock, "1" to unlock
+ */
+void lock_calendar(int port_index, int action) {
+   struct sembuf my_op;
+   int result;
+
+   my_op.sem_num = port_index;
+   my_op.sem_flg = SEM_UNDO;
    my_op.sem_op = action;
 
    do {
-      result = semop(ports_infos[port_dest_index].quays_id, &my_op, 1);
+      result = ipc_semop(shared_header->quays_lock_id, &my_op, 1);
    } while(errno == EINTR && result == -1);
 }
 
 /*
- * This method is used by the ship to take charge of the transportation of a product.
- * If, during the evaluation phase, the trip to the port is evaluated as doable, the
- * ship must take charge of the transportation of a product in a certain quantity
- * expressed in tons (the return value of the method). In order to determine this quantity,
- * the method inspects the value of the semaphore of the given product, since the value in 
- * shared memory might not be updated.
- * The "mode" parameter determines the behaviour of the method:
- *    - if "mode" equals "0", then the ship intends to load a product on board
- *    - if "mode" equals "1", then the ship intends to deliver the product to the port
+ * This method looks at the quays calendar of the given port and returns the instant in which
+ * a ship arriving at "eta" will be able to access a quay, according to the bookings.
+ * If "quay" is not NULL, it is valued with the index of the quay that will be free first.
+ * The calendar is read without locking: the value is an estimate used to evaluate the trips
  */
-int reserve_product(int prod_ind, int mode) {
-   struct sembuf my_reserve;
-   int result, max_quantity = -1, curr_sem_val = 0;
+double earliest_quay_slot(int port_index, double eta, int *quay) {
+   int i, best = 0;
+   double *calendar = quays_calendar + port_index * so_banchine;
 
-   if(mode == 0) {
-      ports_infos[port_dest_index].my_products_offer = 
-      (struct product *) shmat(ports_infos[port_dest_index].off_shm_id, NULL, 0);
+   for(i=1; i<all_ports_stats[port_index].total_quays; i++) {
+      if(calendar[i] < calendar[best]) {
+         best = i;
+      }
+   }
 
-      curr_sem_val = semctl(ports_infos[port_dest_index].my_products_offer[prod_ind].product_semaphore, 0, GETVAL);
+   if(quay != NULL) {
+      *quay = best;
+   }
 
-      if(curr_sem_val <= 0) {
-         return -1;
-      }
+   return (calendar[best] > eta) ? calendar[best] : eta;
+}
 
-      if(curr_sem_val < current_capacity) {
-         max_quantity = curr_sem_val;
-      } else {
-         max_quantity = current_capacity;
-      }
+/*
+ * This method books a quay of the destination port for the time needed
+ * to complete the planned exchange, starting from the first free slot after "eta"
+ */
+void book_quay(double eta, double duration) {
+   double start;
+
+   lock_calendar(port_dest_index, -1);
+   start = earliest_quay_slot(port_dest_index, eta, &booked_quay);
+   booked_end = start + duration;
+   quays_calendar[port_dest_index * so_banchine + booked_quay] = booked_end;
+   lock_calendar(port_dest_index, 1);
+}
 
-      my_reserve.sem_num = 0;
-      my_reserve.sem_op = -(max_quantity);
-      my_reserve.sem_flg = 0;
+/*
+ * This method is used when the ship leaves the destination port: if the ship finished its 
+ * operations before the end of the booking and nobody booked the quay after it, 
+ * the quay is marked as free from now on
+ */
+void release_quay_booking() {
+   double now = get_sim_time();
+   double *slot;
 
-      do {
-         result = semop(ports_infos[port_dest_index].my_products_offer[prod_ind].product_semaphore, &my_reserve, 1);
-      } while(errno == EINTR && result == -1);
-   } else {
-      ports_infos[port_dest_index].my_products_demand = 
-         (struct product *) shmat(ports_infos[port_dest_index].dem_shm_id, NULL, 0);
+   if(booked_quay == -1) {
+      return;
+   }
 
-      curr_sem_val = semctl(ports_infos[port_dest_index].my_products_demand[prod_ind].product_semaphore, 0, GETVAL);
-      
-      if(curr_sem_val <= 0) {
-         return -1;
-      }
+   lock_calendar(port_dest_index, -1);
+   slot = &quays_calendar[port_dest_index * so_banchine + booked_quay];
+   if(*slot == booked_end && now < booked_end) {
+      *slot = now;
+   }
+   lock_calendar(port_dest_index, 1);
 
-      if(curr_sem_val < current_cargo[prod_ind].ton) {
-         max_quantity = curr_sem_val;
-      } else {
-         max_quantity = current_cargo[prod_ind].ton;
-      }
+   booked_quay = -1;
+}
 
-      my_reserve.sem_num = 0;
-      my_reserve.sem_op = -(max_quantity);
-      my_reserve.sem_flg = 0;
+/*
+ * This method is used by the ship to take charge of the transportation of a product.
+ * If, during the evaluation phase, the trip to the port is evaluated as doable, the
+ * ship must take charge of the transportation of a product in a certain quantity
+ * expressed in tons (the return value of the method, -1 if nothing can be reserved). In order to 
+ * determine this quantity, the method consumes the reservable counter of the given product, since 
+ * the tons in shared memory might not be updated.
+ * The parameter "element" is the index of the product in the catalogue of the destination port.
+ * The "mode" parameter determines the behaviour of the method:
+ *    - if "mode" equals "0", then the ship intends to load a product on board
+ *    - if "mode" equals "1", then the ship intends to deliver the product to the port
+ */
+long reserve_product(int element, int mode) {
+   long max_quantity, taken;
+   int prod_ind = catalogue[element].product_id;
 
-      do {
-         result = semop(ports_infos[port_dest_index].my_products_demand[prod_ind].product_semaphore, &my_reserve, 1);
-      } while(errno == EINTR && result == -1);
+   if(mode == 0) {
+      max_quantity = current_capacity;
+   } else {
+      max_quantity = current_cargo[prod_ind].ton;
+   }
 
+   taken = take_reservable(&catalogue[element].reservable, max_quantity);
+   if(taken <= 0) {
+      ships_usage[my_index].failed_reservations++;
    }
 
-   return max_quantity;
+   return (taken > 0) ? taken : -1;
 }
 
 /*
  * This method is used to exchange products with a port.
+ * The parameter "element" is the index of the product in the catalogue of the destination port.
  * The "mode" parameter determines the behaviour of the method:
  *    - if "mode" equals "0", then the ship intends to load a product on board
  *    - if "mode" equals "1", then the ship intends to deliver the product to the port
  */
-int load_unload_product(int prod_ind, int quantity, int mode) {
+int load_unload_product(int element, long quantity, int mode) {
    time_t seconds;
    struct my_msgbuf new_msg, new_reply;
    struct my_ackbuf confirmation;
-   int i;
+   int i, life, attempts, prod_ind = catalogue[element].product_id;
+   double start = get_sim_time();
    sigset_t my_mask;
    
-   if(mode == 0) {
-      ports_infos[port_dest_index].my_products_offer = 
-         (struct product *) shmat(ports_infos[port_dest_index].off_shm_id, NULL, 0);
-      new_msg.type = 0;
-      new_msg.prod_id = ports_infos[port_dest_index].my_products_offer[prod_ind].product_id;
-   } else {
-      ports_infos[port_dest_index].my_products_demand = 
-         (struct product *) shmat(ports_infos[port_dest_index].dem_shm_id, NULL, 0);
-      new_msg.type = 1;
-      new_msg.prod_id = ports_infos[port_dest_index].my_products_demand[prod_ind].product_id;
-   }
+   new_msg.type = mode;
+   new_msg.prod_id = prod_ind;
 
    new_msg.mtype = (long) 1;
-   new_msg.sender = getpid();
+   new_msg.sender = ship_mtype;
    new_msg.tons = quantity;
+   new_msg.port = port_dest_index;
+
+   ship_trace(mode == 0 ? TRACE_LOAD : TRACE_UNLOAD, port_dest_index, prod_ind, quantity);
 
    /* Sending a message to the destination port to notify him of my presence on a quay */
 
-   while(msgsnd(ports_infos[port_dest_index].msg_queue_id,&new_msg,sizeof(struct my_msgbuf)-sizeof(long), 0)==-1);
+   attempts = 0;
+   while(ipc_msgsnd(ports_infos[port_dest_index].msg_queue_id,&new_msg,sizeof(struct my_msgbuf)-sizeof(long), ipc_wait_flag)==-1) {
+      ship_yield(attempts++);
+   }
    
-   while(msgrcv(ports_infos[port_dest_index].msg_queue_id,&new_reply,sizeof(struct my_msgbuf)-sizeof(long),(long) getpid(),0)==-1);
+   attempts = 0;
+   while(ipc_msgrcv(ports_infos[port_dest_index].msg_queue_id,&new_reply,sizeof(struct my_msgbuf)-sizeof(long),(long) ship_mtype, ipc_wait_flag)==-1) {
+      ship_yield(attempts++);
+   }
 
    /* 
     * Once I receive a reply I either know if the port is available and ready to start the exchange
@@ -563,6 +1264,9 @@ int load_unload_product(int prod_ind, int quantity, int mode) {
     */
 
    if(new_reply.type == -1) {
+      ships_usage[my_index].failed_reservations++;
+      ships_usage[my_index].exchanging += get_sim_time() - start;
+      ship_trace(TRACE_EXCHANGED, port_dest_index, prod_ind, 0);
       return -1;
    }
 
@@ -579,25 +1283,38 @@ int load_unload_product(int prod_ind, int quantity, int mode) {
 
    seconds = (time_t)(quantity / so_loadspeed);
    if(mode == 0) {
-      ports_infos[port_dest_index].my_products_offer = 
-         (struct product *) shmat(ports_infos[port_dest_index].off_shm_id, NULL, 0);
-      if(ports_infos[port_dest_index].my_products_offer[prod_ind].product_life <= seconds + current_day) {
-         do {
-            quantity = quantity / 2;
-            seconds = (time_t)(quantity / so_loadspeed);
-         } while(ports_infos[port_dest_index].my_products_offer[prod_ind].product_life <= seconds + current_day);
-
-      }
+      /* 
+       * The lots that expire first are the first to be loaded, so the life of
+       * the loaded tons is the one of the product before the exchange 
+       */
+      life = catalogue[element].product_life;
    } else {
-      if(current_cargo[prod_ind].product_life <= seconds + current_day) {
-         do {
-            quantity = quantity / 2;
-            seconds = (time_t)(quantity / so_loadspeed);
-         } while(current_cargo[prod_ind].product_life <= seconds + current_day);
+      life = current_cargo[prod_ind].product_life;
+   }
+   if(life <= seconds + current_day) {
+      do {
+         quantity = quantity / 2;
+         seconds = (time_t)(quantity / so_loadspeed);
+      } while(life <= seconds + current_day && quantity > 0);
+   }
+
+   /* 
+    * The tons to unload leave the hold before the exchange: a lot that expired while waiting 
+    * for the port is not unloaded, and the tons being unloaded can't expire on the ship
+    */
+   if(mode == 1) {
+      sigemptyset(&my_mask);
+      sigaddset(&my_mask, SIGUSR2);
+      sigprocmask(SIG_BLOCK, &my_mask, NULL);
+      if(quantity > current_cargo[prod_ind].ton) {
+         quantity = current_cargo[prod_ind].ton;
       }
+      remove_cargo_tons(prod_ind, quantity, 1);
+      sigprocmask(SIG_UNBLOCK, &my_mask, NULL);
+      seconds = (time_t)(quantity / so_loadspeed);
    }
 
-   my_sleep(seconds, (long) (((quantity / so_loadspeed) - seconds) * 1e9));
+   my_sleep(seconds, (long) (((quantity / so_loadspeed) - seconds) * 1e9), SKEW_TRANSFER);
    confirmation.mtype = (long) 100;
    if(mode == 0) {
       confirmation.type = 0;
@@ -607,78 +1324,74 @@ int load_unload_product(int prod_ind, int quantity, int mode) {
    confirmation.prod_id = new_reply.prod_id;
    confirmation.sender = new_reply.sender;
    confirmation.tons = quantity;
+   confirmation.port = port_dest_index;
 
    /* 
     * Nanosleep just ended, notifying the port and waiting for him 
     * to update its local infos and global stats 
     */
 
-   while(msgsnd(ports_infos[port_dest_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), 0) == -1);
+   attempts = 0;
+   while(ipc_msgsnd(ports_infos[port_dest_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), ipc_wait_flag) == -1) {
+      ship_yield(attempts++);
+   }
       
-   while(msgrcv(ports_infos[port_dest_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), (long) getpid(), 0) == -1);
+   attempts = 0;
+   while(ipc_msgrcv(ports_infos[port_dest_index].msg_queue_id, &confirmation, sizeof(struct my_ackbuf) - sizeof(long), (long) ship_mtype, ipc_wait_flag) == -1) {
+      ship_yield(attempts++);
+   }
 
    sigemptyset(&my_mask);
    sigaddset(&my_mask, SIGUSR2);
    sigprocmask(SIG_BLOCK, &my_mask, NULL); 
 
-   all_products_stats = (struct prod_stats *)shmat(prod_stats_shm_id, NULL, 0);
-
-   /* Updating local infos and stats */
+   /* Updating local infos, the port already updated the stats (see serve_confirmation) */
 
    if(mode == 0) {
-      all_products_stats[prod_ind].on_ship += quantity;
-
-      ports_infos[port_dest_index].my_products_offer = 
-         (struct product *) shmat(ports_infos[port_dest_index].off_shm_id, NULL, 0);
-
-      current_cargo[prod_ind].product_id = ports_infos[port_dest_index].my_products_offer[prod_ind].product_id;
-      current_cargo[prod_ind].ton = quantity;
-      current_capacity -= current_cargo[prod_ind].ton;
-      current_cargo[prod_ind].product_life = ports_infos[port_dest_index].my_products_offer[prod_ind].product_life;
-      current_cargo[prod_ind].status = 2;
-      load_counter++;
+      if(quantity > 0) {
+         current_capacity -= quantity;
+         add_cargo_lot(prod_ind, quantity, life);
+      }
    } else {
-      all_products_stats[prod_ind].on_ship -= quantity;
-      current_cargo[prod_ind].ton -= quantity;
       current_capacity += quantity;
-      if(current_cargo[prod_ind].ton == 0) {
-         current_cargo[prod_ind].status = 0;
-         current_cargo[prod_ind].product_life = 0;
-         load_counter--;
-      }
+      ships_usage[my_index].delivered += quantity;
    }
 
    sigprocmask(SIG_UNBLOCK, &my_mask, NULL); 
+   ships_usage[my_index].exchanging += get_sim_time() - start;
+   ship_trace(TRACE_EXCHANGED, port_dest_index, prod_ind, quantity);
 
    return 1;
 }
 
 /*
- * This method handles the bigger part of the lifecycle of a ship:
- *    - determines the best trip to make
- *    - determines which product must be loaded/unloaded first
- *    - simulates the navigation
- *    - handles the access to a port and the leaving as well
- *    - handles the loading/unloading procedures 
- *    - finally updates some stats
+ * This method chooses the next trip of the ship at the given instant:
+ *    - if the ship is empty, the most urgent product that it can load in time, at the cheapest port
+ *    - if the ship is loaded, the cheapest port demanding the product with the most urgent lot on
+ *      board that it can reach in time
+ * The tons of the exchange are reserved. Returns 1 and fills "trip" (port_dest_index is the 
+ * destination) if a trip was found, 0 otherwise
  */
-int navigate() {
-   int most_urgent_index = -1, tons_quantity = 0, i=0, j=0, k=0, cont = 1, check = 0, estimated_tons = 0;
+int plan_trip(double now, struct trip_plan *trip) {
+   int most_urgent_index = -1, element = -1, i=0, j=0, cont = 1;
+   long tons_quantity = 0, estimated_tons = 0;
+   int offers_count;
    int action; /* 0 load, 1 unload */
    float distance;
    int *my_ports;
    time_t seconds, estimated_sec;
+   double eta;
 
    if(current_capacity == so_capacity) { /* Ship is empty */
+      evaluate_ports_cost();
       ports_merge_sort(0, so_porti-1);
-      ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
       for(i=0; i<so_porti && cont; i++) {
-         products_merge_sort(sorted_ports[i], 0, so_merci-1);
-         ports_infos[sorted_ports[i]].my_products_offer = (struct product *)shmat(ports_infos[sorted_ports[i]].off_shm_id, NULL, 0);
-         for(j=0; j<so_merci && cont; j++) {
-            if(ports_infos[sorted_ports[i]].my_products_offer[sorted_products[j]].ton > 0) {
+         offers_count = port_offers(sorted_ports[i]);
+         products_merge_sort(0, offers_count-1);
+         for(j=0; j<offers_count && cont; j++) {
+            if(catalogue[sorted_products[j]].ton > 0) {
                /* Estimating how many tons I can load and how much time it will take to do so, including the navigation */
-               estimated_tons = ports_infos[sorted_ports[i]].my_products_offer[sorted_products[j]].ton;
+               estimated_tons = catalogue[sorted_products[j]].ton;
                distance = get_distance(ports_infos[sorted_ports[i]].coord_x, ports_infos[sorted_ports[i]].coord_y);
                seconds = (time_t) (distance / so_speed);
                estimated_sec = seconds;
@@ -687,10 +1400,13 @@ int navigate() {
                } else {
                   estimated_sec += (time_t) (estimated_tons / so_loadspeed);
                }
-               if(ports_infos[sorted_ports[i]].my_products_offer[sorted_products[j]].product_life > estimated_sec + current_day) {
+               /* Adding the time I will wait for a quay according to the calendar */
+               eta = now + distance / so_speed;
+               estimated_sec += (time_t) ceil(earliest_quay_slot(sorted_ports[i], eta, NULL) - eta);
+               if(catalogue[sorted_products[j]].product_life > estimated_sec + current_day) {
                   port_dest_index = sorted_ports[i];
-                  most_urgent_index = sorted_products[j];
-                  if((tons_quantity = reserve_product(most_urgent_index, 0)) > 0) {
+                  element = sorted_products[j];
+                  if((tons_quantity = reserve_product(element, 0)) > 0) {
                      action = 0;
                      cont = 0;
                   }
@@ -699,100 +1415,185 @@ int navigate() {
          }
       }
       if(cont == 1) {
-         return 1;
+         return 0;
       }
    } else { /* Ship is loaded */
-      products_merge_sort(-1, 0, so_merci-1);
+      if(cargo_heap_size == 0) { /* Everything expired in the meantime */
+         return 0;
+      }
+      evaluate_ports_cost();
       ports_merge_sort(0, so_porti-1);
-      for(i=0; i<so_merci && cont; i++) {
-         if(current_cargo[sorted_cargo[i]].ton > 0) {
-            most_urgent_index = sorted_cargo[i];
-            my_ports = demanding_ports(current_cargo[most_urgent_index].product_id);
-            if(my_ports != NULL) {
-               for(j=0; j<so_porti && cont; j++) { /* Iterating on demanding ports ordered by distance */
-                  if(my_ports[sorted_ports[j]] == 1) { 
-                     /* Estimating how many tons I can unload and how much time it will take to do so, including the navigation */
-                     port_dest_index = sorted_ports[j];
-                     ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
-                     ports_infos[port_dest_index].my_products_demand = shmat(ports_infos[port_dest_index].dem_shm_id, NULL, 0);
-                     estimated_tons = ports_infos[port_dest_index].my_products_demand[most_urgent_index].ton;
-                     distance = get_distance(ports_infos[port_dest_index].coord_x, ports_infos[port_dest_index].coord_y);
-                     seconds = (time_t) (distance / so_speed);
-                     estimated_sec = seconds;
-                     if(estimated_tons > current_cargo[most_urgent_index].ton) {
-                        estimated_sec += (time_t) (current_cargo[most_urgent_index].ton / so_loadspeed);
-                     } else {
-                        estimated_sec += (time_t) (estimated_tons / so_loadspeed);
-                     }
-                     if(current_cargo[most_urgent_index].product_life > estimated_sec + current_day) {
-                        if((tons_quantity = reserve_product(most_urgent_index, 1)) > 0) {
-                           action = 1;
-                           cont = 0;
-                        }
-                     }
-                  }
-               }
-               if(cont == 1) { /* All the demanding ports are unreachable */
-                  return 1;
+      /* The product with the most urgent lot on board is on top of the heap */
+      most_urgent_index = cargo_heap[0];
+      my_ports = demanding_ports(most_urgent_index);
+      if(my_ports == NULL) { /* Nobody is demanding this product */
+         return 0;
+      }
+      for(j=0; j<so_porti && cont; j++) { /* Iterating on demanding ports ordered by cost */
+         if(my_ports[sorted_ports[j]] != -1) { 
+            /* Estimating how many tons I can unload and how much time it will take to do so, including the navigation */
+            port_dest_index = sorted_ports[j];
+            element = my_ports[port_dest_index];
+            estimated_tons = catalogue[element].ton;
+            distance = get_distance(ports_infos[port_dest_index].coord_x, ports_infos[port_dest_index].coord_y);
+            seconds = (time_t) (distance / so_speed);
+            estimated_sec = seconds;
+            if(estimated_tons > current_cargo[most_urgent_index].ton) {
+               estimated_sec += (time_t) (current_cargo[most_urgent_index].ton / so_loadspeed);
+            } else {
+               estimated_sec += (time_t) (estimated_tons / so_loadspeed);
+            }
+            eta = now + distance / so_speed;
+            estimated_sec += (time_t) ceil(earliest_quay_slot(port_dest_index, eta, NULL) - eta);
+            if(current_cargo[most_urgent_index].product_life > estimated_sec + current_day) {
+               if((tons_quantity = reserve_product(element, 1)) > 0) {
+                  action = 1;
+                  cont = 0;
                }
-            } else { /* Nobody is demanding this product */
-               return 1;
             }
          }
       }
-      if(cont == 1) {
-         return 1;
+      free(my_ports);
+      if(cont == 1) { /* All the demanding ports are unreachable */
+         return 0;
       }
    }
 
-   /* Navigating to the port and updating my coordinates */
+   trip->element = element;
+   trip->action = action;
+   trip->most_urgent = most_urgent_index;
+   trip->tons = tons_quantity;
+   trip->distance = distance;
+   trip->seconds = seconds;
+   return 1;
+}
 
-   my_sleep(seconds, (long) (((distance / so_speed) - seconds) * 1e9));
+/*
+ * This method handles the bigger part of the lifecycle of a ship:
+ *    - determines the best trip to make
+ *    - determines which product must be loaded/unloaded first
+ *    - simulates the navigation
+ *    - handles the access to a port and the leaving as well
+ *    - handles the loading/unloading procedures 
+ *    - finally updates some stats
+ */
+int navigate() {
+   int most_urgent_index, element, i=0, cont = 1;
+   long tons_quantity;
+   int offers_count;
+   int action; /* 0 load, 1 unload */
+   int priority;
+   float distance;
+   int visit_size;
+   time_t seconds;
+   double now, departure, arrival, docking;
+   long cargo;
+   struct trip_plan trip;
+   sigset_t my_mask;
+
+   now = get_sim_time();
+
+   if(!plan_trip(now, &trip)) {
+      return 1;
+   }
+   element = trip.element;
+   action = trip.action;
+   most_urgent_index = trip.most_urgent;
+   tons_quantity = trip.tons;
+   distance = trip.distance;
+   seconds = trip.seconds;
+
+   /* Booking a quay at the destination port, then navigating to the port and updating my coordinates */
+
+   book_quay(now + distance / so_speed, tons_quantity / so_loadspeed);
+   __sync_fetch_and_add(&quays_queues[port_dest_index].inbound, 1);
+
+   ship_trace(TRACE_SAIL, port_dest_index, -1, tons_quantity);
+   departure = get_sim_time();
+   cargo = so_capacity - current_capacity;
+   my_sleep(seconds, (long) (((distance / so_speed) - seconds) * 1e9), SKEW_VOYAGE);
+   if(cargo > 0) {
+      ships_usage[my_index].sailing_loaded += get_sim_time() - departure;
+      ships_usage[my_index].ton_distance += (double)cargo * distance;
+   } else {
+      ships_usage[my_index].sailing_empty += get_sim_time() - departure;
+   }
    my_infos.coord_x = ports_infos[port_dest_index].coord_x;
    my_infos.coord_y = ports_infos[port_dest_index].coord_y;
+   __sync_fetch_and_sub(&quays_queues[port_dest_index].inbound, 1);
+   ship_trace(TRACE_ARRIVE, port_dest_index, -1, -1);
 
-   access_leave_port(-1);
+   if(action == 1) {
+      priority = current_cargo[most_urgent_index].product_life;
+   } else {
+      priority = catalogue[element].product_life;
+   }
 
-   all_ports_stats[port_dest_index].occupied_quays++;
+   ship_trace(TRACE_QUAY_WAIT, port_dest_index, -1, -1);
+   arrival = get_sim_time();
+   access_leave_port(-1, priority);
+   docking = get_sim_time();
+   ships_usage[my_index].waiting += docking - arrival;
+   ship_trace(TRACE_DOCK, port_dest_index, -1, -1);
+   __sync_fetch_and_add(&quay_stats[port_dest_index].docks, 1);
+   hdr_record(quay_stats[port_dest_index].wait, &quay_stats[port_dest_index].wait_max, 
+      (unsigned long)((docking - arrival) * 1e6));
+
+   __sync_fetch_and_add(&all_ports_stats[port_dest_index].occupied_quays, 1);
    
-   action == 1 ? all_ships_stats[1]-- : all_ships_stats[0]--;
-   all_ships_stats[2]++;
+   /* 
+    * The cargo might have expired at sea, moving the ship from loaded to empty: SIGUSR2 is 
+    * blocked so that it can't expire between the update of the stats and the new status
+    */
+   sigemptyset(&my_mask);
+   sigaddset(&my_mask, SIGUSR2);
+   sigprocmask(SIG_BLOCK, &my_mask, NULL);
+   stats_update_begin(shared_header);
+   __sync_fetch_and_sub(&all_ships_stats[current_status], 1);
+   __sync_fetch_and_add(&all_ships_stats[2], 1);
+   stats_update_end(shared_header);
    current_status = 2;
+   sigprocmask(SIG_UNBLOCK, &my_mask, NULL);
 
    if(action == 1) { /* Ship has to unload something */
-      load_unload_product(most_urgent_index, tons_quantity, 1);
-      cont = 1;
-      while(current_capacity != so_capacity && cont == 1) { /* Still loaded, let's see if the ship can unload something else */
-         products_merge_sort(-1, 0, so_merci-1);
-         ports_infos[port_dest_index].my_products_demand = shmat(ports_infos[port_dest_index].dem_shm_id, NULL, 0);
-         for(i=0; i<so_merci && cont; i++) {
-            if(current_cargo[sorted_cargo[i]].ton > 0) {
-               if(ports_infos[port_dest_index].my_products_demand[current_cargo[sorted_cargo[i]].product_id].ton > 0) {
-                  if(current_cargo[sorted_cargo[i]].product_life > current_day) {
-                     most_urgent_index = current_cargo[sorted_cargo[i]].product_id;
-                     if((tons_quantity = reserve_product(most_urgent_index, 1)) > 0) {
-                        load_unload_product(most_urgent_index, tons_quantity, 1);
-                     }
+      load_unload_product(element, tons_quantity, 1);
+      /* 
+       * Still loaded, let's see if the ship can unload something else, from the most to the 
+       * less urgent product: the heap is copied, since unloading and expiring products modify it
+       */
+      sigemptyset(&my_mask);
+      sigaddset(&my_mask, SIGUSR2);
+      sigprocmask(SIG_BLOCK, &my_mask, NULL);
+      visit_size = cargo_heap_size;
+      memcpy(cargo_visit, cargo_heap, visit_size * sizeof(int));
+      sigprocmask(SIG_UNBLOCK, &my_mask, NULL);
+      while(visit_size > 0) {
+         most_urgent_index = cargo_visit[0];
+         visit_size--;
+         cargo_visit[0] = cargo_visit[visit_size];
+         cargo_heap_down(cargo_visit, visit_size, 0);
+         element = find_product(catalogue, port_dest_index * catalogue_stride, 
+            ports_infos[port_dest_index].products_count, most_urgent_index);
+         if(current_cargo[most_urgent_index].ton > 0 && element != -1) {
+            if(catalogue[element].type == 1 && catalogue[element].ton > 0) {
+               if(current_cargo[most_urgent_index].product_life > current_day) {
+                  if((tons_quantity = reserve_product(element, 1)) > 0) {
+                     load_unload_product(element, tons_quantity, 1);
                   }
                }
             }
          }
-         if(cont == 0 && current_capacity != so_merci) { /* Unloaded something but maybe there's more to unload, retry */
-            cont = 1;
-         } else if(i == so_merci) { /* Cannot unload anything else */
-            cont = 0;
-         }
       }
       /* At this point the ship unloaded everything suitable product,
        * now let's check if something can be loaded before leaving */
-      products_merge_sort(port_dest_index, 0, so_merci-1);
-      ports_infos[port_dest_index].my_products_offer = shmat(ports_infos[port_dest_index].off_shm_id, NULL, 0);
+      offers_count = port_offers(port_dest_index);
+      products_merge_sort(0, offers_count-1);
       cont = 1;
-      for(i=0; i<so_merci && cont; i++) {
-         if(ports_infos[port_dest_index].my_products_offer[sorted_products[i]].ton > 0) {
-            if(ports_infos[port_dest_index].my_products_offer[sorted_products[i]].product_life > current_day) {
-               most_urgent_index = sorted_products[i];
-               if((tons_quantity = reserve_product(most_urgent_index, 0)) > 0) {
+      for(i=0; i<offers_count && cont; i++) {
+         if(catalogue[sorted_products[i]].ton > 0) {
+            if(catalogue[sorted_products[i]].product_life > current_day) {
+               element = sorted_products[i];
+               if((tons_quantity = reserve_product(element, 0)) > 0) {
                   action = 0;
                   cont = 0;
                }
@@ -802,22 +1603,22 @@ int navigate() {
    }
 
    if(action == 0) { /* Ship is going to load something */
-      load_unload_product(most_urgent_index, tons_quantity, 0);
+      load_unload_product(element, tons_quantity, 0);
       cont = 1;
       while(current_capacity > 0 && cont == 1) { /* Some space left, let's see if the ship can load something else */
-         products_merge_sort(port_dest_index, 0, so_merci-1);
-         for(i=0; i<so_merci && cont; i++) {
-            ports_infos[port_dest_index].my_products_offer = shmat(ports_infos[port_dest_index].off_shm_id, NULL, 0);
-            if(ports_infos[port_dest_index].my_products_offer[sorted_products[i]].ton > 0) {
-               if(ports_infos[port_dest_index].my_products_offer[sorted_products[i]].product_life > current_day) {
-                  most_urgent_index = sorted_products[i];
-                  if((tons_quantity = reserve_product(most_urgent_index, 0)) > 0) {
-                     load_unload_product(most_urgent_index, tons_quantity, 0);
+         offers_count = port_offers(port_dest_index);
+         products_merge_sort(0, offers_count-1);
+         for(i=0; i<offers_count && cont; i++) {
+            if(catalogue[sorted_products[i]].ton > 0) {
+               if(catalogue[sorted_products[i]].product_life > current_day) {
+                  element = sorted_products[i];
+                  if((tons_quantity = reserve_product(element, 0)) > 0) {
+                     load_unload_product(element, tons_quantity, 0);
                   }
                }
             }
          }
-         if(i == so_merci) {
+         if(i == offers_count) {
             cont = 0;
          }
       }
@@ -825,78 +1626,112 @@ int navigate() {
 
    /* Loading / Unloading procedure completed, now leaving the port and updating some stats */
 
-   access_leave_port(1);
-   all_ports_stats[port_dest_index].occupied_quays--;
+   access_leave_port(1, 0);
+   hdr_record(quay_stats[port_dest_index].hold, &quay_stats[port_dest_index].hold_max, 
+      (unsigned long)((get_sim_time() - docking) * 1e6));
+   release_quay_booking();
+   __sync_fetch_and_sub(&all_ports_stats[port_dest_index].occupied_quays, 1);
 
-   all_ships_stats[2]--;
-   if(current_capacity == so_capacity) { 
-      all_ships_stats[0]++;
-      current_status = 0;
-   } else { 
-      all_ships_stats[1]++;
-      current_status = 1;
-   }
+   sigemptyset(&my_mask);
+   sigaddset(&my_mask, SIGUSR2);
+   sigprocmask(SIG_BLOCK, &my_mask, NULL);
+   current_status = (current_capacity == so_capacity) ? 0 : 1;
+   stats_update_begin(shared_header);
+   __sync_fetch_and_sub(&all_ships_stats[2], 1);
+   __sync_fetch_and_add(&all_ships_stats[current_status], 1);
+   stats_update_end(shared_header);
+   sigprocmask(SIG_UNBLOCK, &my_mask, NULL);
 
    return 1;
 }
 
 /*
- * This method returns an array of integers where the elements initialized with "1" indicating
- * that the correspondent port is demanding the given product.
+ * This method returns an array of integers where each element contains the index in the catalogue
+ * of the given product if the correspondent port is demanding it, -1 otherwise. Only the ports 
+ * in the list of the product (see struct shared_header) are examined
  */
 int *demanding_ports(int prod_id) {
    int *res = malloc(so_porti * sizeof(int));
-   int i, at_least_one = 0, check = 0;
-
-   ports_infos = (struct port_info *)shmat(shm_id, NULL, 0);
+   int *elements = product_index + so_merci + 1;
+   int i, element, at_least_one = 0;
 
    for(i=0; i<so_porti; i++) {
-      ports_infos[sorted_ports[i]].my_products_demand = (struct product *)shmat(ports_infos[sorted_ports[i]].dem_shm_id, NULL, 0);
-      check = ports_infos[sorted_ports[i]].my_products_demand[prod_id].ton != 0;
-      if(check) {
-         res[sorted_ports[i]] = 1;
+      res[i] = -1;
+   }
+   for(i=product_index[prod_id]; i<product_index[prod_id + 1]; i++) {
+      element = elements[i];
+      if(catalogue[element].type == 1 && catalogue[element].ton != 0) {
+         res[element / catalogue_stride] = element;
          at_least_one++;
-      } else {
-         res[sorted_ports[i]] = 0;
       }
    }
 
-   return (at_least_one > 0) ? res :  NULL;
+   if(at_least_one == 0) {
+      free(res);
+      return NULL;
+   }
+   return res;
 }
 
+/*
+ * This method removes the expired lots from the hold: the lots are taken from the top of the
+ * heap, so only the expired ones are examined
+ */
 void check_expiring_products() {
    int i;
+   long tons;
    
-   for(i=0; i<so_merci; i++) {
-      if(current_cargo[i].ton > 0 && current_cargo[i].product_life <= current_day) {
-         all_products_stats[i].on_ship -= current_cargo[i].ton;
-         all_products_stats[i].expired_ship += current_cargo[i].ton;
-         current_capacity += current_cargo[i].ton;
-         current_cargo[i].ton = 0;
-         current_cargo[i].status = 0;
-         current_cargo[i].product_life = 0;
-         load_counter--;
-         if(load_counter == 0 && current_status == 1) {
-            all_ships_stats[1]--;
-            all_ships_stats[0]++;
-            current_status = 0;
-         }
-      }
+   while(cargo_heap_size > 0 && current_cargo[cargo_heap[0]].product_life <= current_day) {
+      i = cargo_heap[0];
+      tons = cargo_lots[current_cargo[i].first_lot].ton;
+      stats_update_begin(shared_header);
+      __sync_fetch_and_sub(&all_products_stats[i].on_ship, tons);
+      __sync_fetch_and_add(&all_products_stats[i].expired_ship, tons);
+      stats_update_end(shared_header);
+      ship_trace(TRACE_SHIP_EXPIRE, -1, i, tons);
+      ships_usage[my_index].expired += tons;
+      current_capacity += tons;
+      remove_cargo_tons(i, tons, 0);
+   }
+   if(cargo_heap_size == 0 && current_status == 1) {
+      stats_update_begin(shared_header);
+      __sync_fetch_and_sub(&all_ships_stats[1], 1);
+      __sync_fetch_and_add(&all_ships_stats[0], 1);
+      stats_update_end(shared_header);
+      current_status = 0;
+   }
+}
+
+/*
+ * This method traces an event of the ship in its trace ring, if the events are traced
+ */
+void ship_trace(int type, int port, int product, long tons) {
+   if(trace_rings != NULL) {
+      trace_emit(shared_header, &trace_rings[so_porti + my_index], type, port, product, tons);
    }
 }
 
 /*
  * This method executes a nanosleep with the given parameters.
  * It uses a while in order to keep working properly when, during the nanosleep,
- * a signal is delivered to the process and the signal handler is executed
+ * a signal is delivered to the process and the signal handler is executed.
+ * In executor mode the ship is suspended instead, letting the other ships run.
+ * The delay of the wake-up is recorded as a sleep of the given kind (see struct sleep_skew)
  */
-void my_sleep(time_t seconds, long nano) {
+void my_sleep(time_t seconds, long nano, int kind) {
    struct timespec sleeping, remaining;
+   double requested = get_sim_time() + seconds + nano / 1e9;
 
-   sleeping.tv_sec = seconds;
-   sleeping.tv_nsec = nano;
-   while(nanosleep(&sleeping, &remaining) == -1) {
-      sleeping.tv_sec = remaining.tv_sec;
-      sleeping.tv_nsec = remaining.tv_nsec;
+   if(executors > 0) {
+      executor_sleep(seconds + nano / 1e9);
+   } else {
+      sleeping.tv_sec = seconds;
+      sleeping.tv_nsec = nano;
+      while(nanosleep(&sleeping, &remaining) == -1) {
+         sleeping.tv_sec = remaining.tv_sec;
+         sleeping.tv_nsec = remaining.tv_nsec;
+      }
    }
+
+   skew_record(shared_header, kind, requested, get_sim_time());
 }
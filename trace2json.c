@@ -0,0 +1,63 @@
+#include "utils.h"
+
+/* Names of the traced events (see TRACE_SAIL) */
+const char *trace_names[TRACE_TYPES] = {"sail", "sail", "quay_wait", "quay_wait", "load", "unload",
+   "exchange", "reject", "ship_expire", "port_expire", "generate"};
+
+/* Chrome trace phases of the traced events: B begins a slice, E ends it, i is an instant */
+const char *trace_phases[TRACE_TYPES] = {"B", "E", "B", "E", "B", "B", "E", "i", "i", "i", "i"};
+
+int main(int argc, char *argv[]) {
+   struct trace_file_record record;
+   unsigned int version;
+   char magic[4];
+   int ports, ships, i;
+   FILE *trace;
+
+   if(argc != 2) {
+      fprintf(stderr, "Usage: %s TRACE_FILE > TRACE.json\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   if((trace = fopen(argv[1], "rb")) == NULL) {
+      perror("trace file open failed!");
+      return EXIT_FAILURE;
+   }
+   if(fread(magic, 1, 4, trace) != 4 || memcmp(magic, "SOTR", 4) != 0
+         || fread(&version, sizeof(version), 1, trace) != 1 || version != 1
+         || fread(&ports, sizeof(int), 1, trace) != 1 || fread(&ships, sizeof(int), 1, trace) != 1) {
+      fprintf(stderr, "%s is not a trace file!\n", argv[1]);
+      return EXIT_FAILURE;
+   }
+
+   /*
+    * The ports are the threads of the process 1, the ships the threads of the process 2:
+    * the Chrome trace viewer and Perfetto show each of them on its own track
+    */
+   printf("{\"traceEvents\":[\n");
+   printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Ports\"}},\n");
+   printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"Ships\"}}");
+   for(i=0; i<ports; i++) {
+      printf(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Port %d\"}}", i, i);
+   }
+   for(i=0; i<ships; i++) {
+      printf(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":%d,\"args\":{\"name\":\"Ship %d\"}}", i, i);
+   }
+
+   while(fread(&record, sizeof(record), 1, trace) == 1) {
+      if(record.event.type < 0 || record.event.type >= TRACE_TYPES || record.ring < 0 || record.ring >= ports + ships) {
+         continue;
+      }
+      printf(",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+         trace_names[record.event.type], trace_phases[record.event.type], record.event.time * 1e6,
+         record.ring < ports ? 1 : 2, record.ring < ports ? record.ring : record.ring - ports);
+      if(trace_phases[record.event.type][0] == 'i') {
+         printf(",\"s\":\"t\"");
+      }
+      printf(",\"args\":{\"port\":%d,\"product\":%d,\"tons\":%ld}}",
+         record.event.port, record.event.product, record.event.tons);
+   }
+   printf("\n]}\n");
+
+   fclose(trace);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,386 @@
+#include "utils.h"
+
+/*
+ * This method looks for the given product in the catalogue of a port, that starts at
+ * index "first" and has "count" elements ordered by product_id (see struct shared_header).
+ * Returns the index of the element in the catalogue, -1 if the port doesn't trade the product
+ */
+int find_product(struct product *catalogue, int first, int count, int prod_id) {
+   int left = first, right = first + count - 1, mid;
+
+   while(left <= right) {
+      mid = left + (right - left) / 2;
+      if(catalogue[mid].product_id == prod_id) {
+         return mid;
+      } else if(catalogue[mid].product_id < prod_id) {
+         left = mid + 1;
+      } else {
+         right = mid - 1;
+      }
+   }
+
+   return -1;
+}
+
+/*
+ * This method atomically takes at most "max" tons from the given reservable counter 
+ * (see struct product) and returns the tons taken, 0 if the counter is empty
+ */
+long take_reservable(long *counter, long max) {
+   long val, taken;
+
+   do {
+      val = *counter;
+      if(val <= 0) {
+         return 0;
+      }
+      taken = (val < max) ? val : max;
+   } while(!__sync_bool_compare_and_swap(counter, val, val - taken));
+
+   return taken;
+}
+
+/*
+ * This method atomically gives back the given tons to the reservable counter (see struct product)
+ */
+void give_reservable(long *counter, long tons) {
+   __sync_fetch_and_add(counter, tons);
+}
+
+/*
+ * This method is used in zygote mode to turn the calling process into "count" processes with
+ * the same state. The forks are made in parallel: each process is responsible of a range of 
+ * processes, forks a child responsible of the upper half of the range and keeps the lower half, 
+ * until its range contains only itself. Every process returns from this method
+ */
+void spawn_processes(int count) {
+   int first = 0, last = count, mid;
+   pid_t pid;
+
+   while(last - first > 1) {
+      mid = first + (last - first) / 2;
+      pid = fork();
+      if(pid == -1) {
+         perror("fork failed!");
+         exit(EXIT_FAILURE);
+      } else if(pid == 0) {
+         first = mid;
+      } else {
+         last = mid;
+      }
+   }
+}
+
+/*
+ * These methods surround a group of updates of the stats (see struct shared_header): 
+ * the copy taken by the master never contains only a part of the group
+ */
+void stats_update_begin(struct shared_header *header) {
+   __sync_fetch_and_add(&header->stats_begin, 1);
+}
+
+void stats_update_end(struct shared_header *header) {
+   __sync_fetch_and_add(&header->stats_end, 1);
+}
+
+/*
+ * This method sets the number of the semaphore of the ship with the given index in the given 
+ * operation and returns the id of its semaphores array (see struct shared_header)
+ */
+int ship_semaphore(struct shared_header *header, int index, struct sembuf *op) {
+   op->sem_num = index % header->ships_per_sem_set;
+
+   return header->ships_sem_ids[index / header->ships_per_sem_set];
+}
+
+/*
+ * This method writes an event in the given trace ring, tagged with the current simulated time.
+ * The event is published only after it was written, if the ring is full the event is lost
+ */
+void trace_emit(struct shared_header *header, struct trace_ring *ring, int type, int port, int product, long tons) {
+   struct trace_event *event;
+   struct timespec now;
+   unsigned long head;
+
+   if(ring->busy) { /* Called by a signal handler while the writer is writing */
+      __sync_fetch_and_add(&ring->dropped, 1);
+      return;
+   }
+   ring->busy = 1;
+   __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+   head = ring->head;
+   if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+      __sync_fetch_and_add(&ring->dropped, 1);
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+      ring->busy = 0;
+      return;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+   event->time = (now.tv_sec - header->sim_start.tv_sec) + (now.tv_nsec - header->sim_start.tv_nsec) / 1e9;
+   event->type = type;
+   event->port = port;
+   event->product = product;
+   event->tons = tons;
+
+   __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+   __atomic_signal_fence(__ATOMIC_SEQ_CST);
+   ring->busy = 0;
+}
+
+/*
+ * The IPC calls of this process are accounted here (see struct ipc_call_stats), then added to the
+ * ones of its role in the shared header when it ends. The threads of a port in server mode
+ * and the signal handlers account their calls too, so the counters are updated atomically
+ */
+struct ipc_call_stats ipc_local_stats[IPC_CALLS];
+
+void ipc_account(int call, struct timespec *start, int failed) {
+   struct ipc_call_stats *stats = &ipc_local_stats[call];
+   struct timespec now;
+   unsigned long ns, max;
+   int bucket, saved_errno = errno;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   ns = (unsigned long)((now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec));
+   bucket = ns > 1 ? 63 - __builtin_clzl(ns) : 0;
+   if(bucket >= IPC_HISTOGRAM_BUCKETS) {
+      bucket = IPC_HISTOGRAM_BUCKETS - 1;
+   }
+
+   __sync_fetch_and_add(&stats->calls, 1);
+   __sync_fetch_and_add(&stats->total_ns, ns);
+   __sync_fetch_and_add(&stats->histogram[bucket], 1);
+   if(failed) {
+      __sync_fetch_and_add(&stats->failed, 1);
+   }
+   while(ns > (max = stats->max_ns) && !__sync_bool_compare_and_swap(&stats->max_ns, max, ns));
+
+   errno = saved_errno;
+}
+
+int ipc_semop(int id, struct sembuf *ops, size_t count) {
+   struct timespec start;
+   int result;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   result = semop(id, ops, count);
+   ipc_account(IPC_CALL_SEMOP, &start, result == -1);
+   return result;
+}
+
+int ipc_semctl(int id, int num, int cmd, union semun arg) {
+   struct timespec start;
+   int result;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   result = semctl(id, num, cmd, arg);
+   ipc_account(IPC_CALL_SEMCTL, &start, result == -1);
+   return result;
+}
+
+int ipc_msgsnd(int id, const void *msg, size_t size, int flags) {
+   struct timespec start;
+   int result;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   result = msgsnd(id, msg, size, flags);
+   ipc_account(IPC_CALL_MSGSND, &start, result == -1);
+   return result;
+}
+
+ssize_t ipc_msgrcv(int id, void *msg, size_t size, long type, int flags) {
+   struct timespec start;
+   ssize_t result;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   result = msgrcv(id, msg, size, type, flags);
+   ipc_account(IPC_CALL_MSGRCV, &start, result == -1);
+   return result;
+}
+
+void *ipc_shmat(int id, const void *address, int flags) {
+   struct timespec start;
+   void *result;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   result = shmat(id, address, flags);
+   ipc_account(IPC_CALL_SHMAT, &start, result == (void *)-1);
+   return result;
+}
+
+int ipc_shmdt(const void *address) {
+   struct timespec start;
+   int result;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   result = shmdt(address);
+   ipc_account(IPC_CALL_SHMDT, &start, result == -1);
+   return result;
+}
+
+/*
+ * This method adds the IPC calls accounted by this process to the ones of its role
+ * in the shared header, then resets them so that they are added only once
+ */
+void ipc_stats_publish(struct shared_header *header, int role) {
+   struct ipc_call_stats *local, *shared;
+   unsigned long max;
+   int i, j;
+
+   for(i=0; i<IPC_CALLS; i++) {
+      local = &ipc_local_stats[i];
+      shared = &header->ipc_stats[role][i];
+      __sync_fetch_and_add(&shared->calls, local->calls);
+      __sync_fetch_and_add(&shared->failed, local->failed);
+      __sync_fetch_and_add(&shared->total_ns, local->total_ns);
+      for(j=0; j<IPC_HISTOGRAM_BUCKETS; j++) {
+         __sync_fetch_and_add(&shared->histogram[j], local->histogram[j]);
+      }
+      while(local->max_ns > (max = shared->max_ns) && !__sync_bool_compare_and_swap(&shared->max_ns, max, local->max_ns));
+   }
+   bzero(ipc_local_stats, sizeof(ipc_local_stats));
+}
+
+/*
+ * These methods handle a histogram with a bounded relative error (see HDR_SUB_BITS): a value
+ * is recorded in the bucket of its power of 2 given by its next HDR_SUB_BITS bits, so that 
+ * the values of a bucket differ by less than 1 / HDR_SUB_BUCKETS
+ */
+int hdr_bucket(unsigned long value) {
+   int exponent, bucket;
+
+   if(value < HDR_SUB_BUCKETS) {
+      return (int)value;
+   }
+   exponent = 63 - __builtin_clzl(value);
+   bucket = (exponent - HDR_SUB_BITS + 1) * HDR_SUB_BUCKETS + 
+      (int)((value >> (exponent - HDR_SUB_BITS)) & (HDR_SUB_BUCKETS - 1));
+
+   return bucket < HDR_BUCKETS ? bucket : HDR_BUCKETS - 1;
+}
+
+/* The highest value recorded in the given bucket */
+unsigned long hdr_bucket_value(int bucket) {
+   int exponent;
+
+   if(bucket < HDR_SUB_BUCKETS) {
+      return (unsigned long)bucket;
+   }
+   exponent = bucket / HDR_SUB_BUCKETS + HDR_SUB_BITS - 1;
+
+   return ((unsigned long)(HDR_SUB_BUCKETS + bucket % HDR_SUB_BUCKETS + 1) << (exponent - HDR_SUB_BITS)) - 1;
+}
+
+/* Records the value in the histogram and in the maximum, shared by many processes */
+void hdr_record(unsigned long *histogram, unsigned long *max, unsigned long value) {
+   unsigned long old;
+
+   __sync_fetch_and_add(&histogram[hdr_bucket(value)], 1);
+   while(value > (old = *max) && !__sync_bool_compare_and_swap(max, old, value));
+}
+
+/* 
+ * Returns the highest value of the bucket that contains the given fraction of the values,
+ * or the maximum value recorded if it's lower
+ */
+unsigned long hdr_percentile(unsigned long *histogram, unsigned long max, double fraction) {
+   unsigned long total = 0, count = 0;
+   int i;
+
+   for(i=0; i<HDR_BUCKETS; i++) {
+      total += histogram[i];
+   }
+   if(total == 0) {
+      return 0;
+   }
+   for(i=0; i<HDR_BUCKETS - 1; i++) {
+      count += histogram[i];
+      if(count >= fraction * total) {
+         break;
+      }
+   }
+
+   return hdr_bucket_value(i) < max ? hdr_bucket_value(i) : max;
+}
+
+/*
+ * This method mixes a 64 bit value (the finalizer of splitmix64): close values give unrelated results
+ */
+uint64_t random_mix(uint64_t x) {
+   x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+   x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+   return x ^ (x >> 31);
+}
+
+/*
+ * This method seeds the stream of random numbers of the entity with the given role and index
+ * from the seed of the run: the four words of the state are drawn by splitmix64, as suggested
+ * by the authors of xoshiro, starting from the mix of the seed and of the entity
+ */
+void random_seed(struct random_state *state, unsigned long seed, int role, int index) {
+   uint64_t x;
+   int i;
+
+   x = random_mix(seed) ^ random_mix(((uint64_t)role << 32) | (uint32_t)index);
+   for(i=0; i<4; i++) {
+      x += 0x9e3779b97f4a7c15UL;
+      state->s[i] = random_mix(x);
+   }
+}
+
+/*
+ * This method returns the next 64 bits of the stream (xoshiro256**)
+ */
+uint64_t random_next(struct random_state *state) {
+   uint64_t *s = state->s;
+   uint64_t result, t;
+
+   result = s[1] * 5;
+   result = ((result << 7) | (result >> 57)) * 9;
+   t = s[1] << 17;
+
+   s[2] ^= s[0];
+   s[3] ^= s[1];
+   s[1] ^= s[2];
+   s[0] ^= s[3];
+   s[2] ^= t;
+   s[3] = (s[3] << 45) | (s[3] >> 19);
+
+   return result;
+}
+
+/*
+ * This method returns a random number between 0 and bound - 1: the bias of the modulo
+ * on the top 53 bits is negligible for the bounds of the simulation
+ */
+long random_below(struct random_state *state, long bound) {
+   return (long)((random_next(state) >> 11) % (uint64_t)bound);
+}
+
+/*
+ * This method returns a random number in [0, 1)
+ */
+double random_unit(struct random_state *state) {
+   return (random_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * This method records the delay of a sleep of the given kind that should have ended at the
+ * "requested" simulated time and ended at "actual" (see struct sleep_skew)
+ */
+void skew_record(struct shared_header *header, int kind, double requested, double actual) {
+   struct sleep_skew *skew = &header->skew[kind];
+   double delay = actual - requested;
+
+   __sync_fetch_and_add(&skew->sleeps, 1);
+   if(delay < 0) {
+      delay = 0;
+   }
+   if((long)actual > (long)requested) { /* The simulated times are never negative */
+      __sync_fetch_and_add(&skew->missed, 1);
+   }
+   hdr_record(skew->histogram, &skew->max, (unsigned long)(delay * 1e6));
+}
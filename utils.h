@@ -1,7 +1,126 @@
 #define _GNU_SOURCE
 
-#define SHIP_PARAMS_COUNT 12
-#define PORT_PARAMS_COUNT 12
+#define SHIP_PARAMS_COUNT 13
+#define PORT_PARAMS_COUNT 13
+
+/* 
+ * Maximum number of times a ship waiting for a quay can be overtaken by
+ * more urgent ships before it gets the first quay that becomes free
+ */
+#define QUAY_MAX_BYPASS 4
+
+/* 
+ * Tags of the events watched by the event loop of the master: the pidfds of the
+ * ports and of the ships are tagged with their index (ships after the ports)
+ */
+#define EVENT_DAY_TIMER -1
+#define EVENT_SIGNALS -2
+#define EVENT_TRACE_TIMER -3
+#define EVENT_QUAY_TIMER -4
+
+/* 
+ * Number of events of each trace ring (a power of 2, see struct trace_ring) and
+ * interval (in milliseconds) after which the master drains the rings
+ */
+#define TRACE_RING_SIZE 256
+#define TRACE_DRAIN_INTERVAL 50
+
+/* 
+ * Types of the traced events: the ones marked as begin are followed by the matching end
+ * event of the same ship, the others are instants
+ */
+#define TRACE_SAIL 0         /* begin: the ship sails to a port */
+#define TRACE_ARRIVE 1       /* end of TRACE_SAIL */
+#define TRACE_QUAY_WAIT 2    /* begin: the ship waits for a quay */
+#define TRACE_DOCK 3         /* end of TRACE_QUAY_WAIT */
+#define TRACE_LOAD 4         /* begin: the ship loads a product */
+#define TRACE_UNLOAD 5       /* begin: the ship unloads a product */
+#define TRACE_EXCHANGED 6    /* end of TRACE_LOAD or TRACE_UNLOAD, with the tons exchanged */
+#define TRACE_REJECT 7       /* the port rejected the request of a ship */
+#define TRACE_SHIP_EXPIRE 8  /* tons expired on the ship */
+#define TRACE_PORT_EXPIRE 9  /* tons expired in the port */
+#define TRACE_GENERATE 10    /* tons generated by the port */
+#define TRACE_TYPES 11
+
+/* Text reports of the master (see --report) */
+#define REPORT_FULL 0
+#define REPORT_SUMMARY 1
+#define REPORT_NONE 2
+
+/* 
+ * Roles of the processes and IPC calls whose latency is accounted (see struct ipc_call_stats):
+ * the latency of the call with index b of the histogram is between 2^b and 2^(b+1) ns
+ */
+#define IPC_ROLE_MASTER 0
+#define IPC_ROLE_PORT 1
+#define IPC_ROLE_SHIP 2
+#define IPC_ROLES 3
+#define IPC_CALL_SEMOP 0
+#define IPC_CALL_SEMCTL 1
+#define IPC_CALL_MSGSND 2
+#define IPC_CALL_MSGRCV 3
+#define IPC_CALL_SHMAT 4
+#define IPC_CALL_SHMDT 5
+#define IPC_CALLS 6
+#define IPC_HISTOGRAM_BUCKETS 32
+
+/* 
+ * Histograms with a bounded relative error (see hdr_record): the values below HDR_SUB_BUCKETS have 
+ * a bucket each, then each power of 2 is split in HDR_SUB_BUCKETS buckets, up to 2^36
+ */
+#define HDR_SUB_BITS 3
+#define HDR_SUB_BUCKETS (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS 272
+
+/* 
+ * Size of the table of the lanes of each ship process (a power of 2, see struct lane): it's added 
+ * to the shared pool when LANE_TABLE_FLUSH lanes are used. The pool has SO_PORTI * SO_PORTI
+ * elements plus LANE_POOL_PER_SHIP for each ship. The report shows the LANE_TOP lanes
+ */
+#define LANE_TABLE_SIZE 256
+#define LANE_TABLE_FLUSH 192
+#define LANE_POOL_PER_SHIP 32
+#define LANE_TOP 10
+
+/* 
+ * Sleeps whose delay from the requested wake-up is measured (see struct sleep_skew): 
+ * the navigations and the exchanges of the ships, and the days of the master
+ */
+#define SKEW_VOYAGE 0
+#define SKEW_TRANSFER 1
+#define SKEW_DAY_TICK 2
+#define SKEW_KINDS 3
+
+/* Number of processes that used the most CPU shown by the report of the resource usage */
+#define RUSAGE_TOP 5
+
+/* Interval (in milliseconds) after which the master samples the queues of the quays */
+#define QUAY_SAMPLE_INTERVAL 100
+
+/* 
+ * Times the master tries to copy the stats while no group of updates is in progress, 
+ * before taking a copy anyway (see take_stats_snapshot)
+ */
+#define SNAPSHOT_MAX_RETRIES 1000
+
+/* 
+ * Maximum number of the sets of semaphores that wake up the waiting ships: a set holds at most
+ * SEMMSL semaphores (32000 by default), so the ships are split among up to SHIP_SEM_SETS sets
+ */
+#define SHIP_SEM_SETS 16
+
+/* Seconds the master waits for the processes to exit at the end, before killing them */
+#define SHUTDOWN_TIMEOUT 5
+
+/* 
+ * The shared header is created with the key ftok(".", IPC_REGISTRY_PROJ), so that the
+ * IPC objects of a run that crashed can be found (see struct ipc_registry)
+ */
+#define IPC_REGISTRY_PROJ 'S'
+#define IPC_REGISTRY_SIZE (24 + SHIP_SEM_SETS)
+#define IPC_OBJECT_SHM 0
+#define IPC_OBJECT_SEM 1
+#define IPC_OBJECT_MSG 2
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,9 +138,25 @@
 #include <sys/sem.h>
 #include <sys/shm.h>
 #include <sys/msg.h>
+#include <sys/prctl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/pidfd.h>
+#include <fcntl.h>
 
 /* Structs */
 
+/*
+ * All the quantities of products are expressed in tons and stored as long (64 bit on the 
+ * LP64 platforms we run on), so that neither the big lots nor the aggregates of long runs overflow
+ */
+
 /*
  * 
  * This struct represents a single product with all its relevant infos:
@@ -36,26 +171,80 @@
  *          3) Delivered to a port
  *          4) Expired in a port
  *          5) Expired in a ship 
- *    - the id of the product' semaphore. This semaphore is used by ships in order to take charge of a single
- *      product in the context of loading it or unloading it. This semaphore is initially valorized with the
- *      ton value. Example: 
+ *    - the reservable tons of the product. This counter is used by ships in order to take charge of a single
+ *      product in the context of loading it or unloading it. This counter is initially valorized with the
+ *      ton value and is only modified atomically (see take_reservable and give_reservable). Example: 
  *          The "X" port demands 100 tons of "prod_1"; the ship "1" transports 50 tons of
- *          "prod_1" so decides to consume the semaphore with a semop, leaving the sem value to 50, 
+ *          "prod_1" so decides to consume the counter, leaving its value to 50, 
  *          committing to serve (partially) the port's demand. If the ship "2" is transporting
  *          70 tons of "prod_1" and sees that the port "X" needs 100 tons of "prod_1", the boat 
  *          may think that all of its 70 tons can be delivered to the port, but looking at the
- *          semaphore value the boat learns that only 50 tons can be delivered.
+ *          counter value the boat learns that only 50 tons can be delivered.
  *      With this implementation we avoid "pointless" trips due to a possible inconsistency of the 
  *      demand tons value, that needs to stay the same until the prods are actually delivered to the port
  *      for statistics purposes. This principle is applied for both the offer and the demand.
+ *    - the index of the first lot of the product in the lots pool (see struct lot), -1 if there
+ *      are no lots. The offer of a product is made of one or more lots, each one with its own life:
+ *      in this case "ton" is the sum of the tons of the lots and "product_life" is the life of 
+ *      the lot that expires first. The demand has no lots.
+ *    - the type of the product in the catalogue of a port: 0 if the port offers it, 1 if the
+ *      port demands it. A port never offers and demands the same product
  * 
  */
 struct product {
    int product_id; 
-   int ton; 
+   long ton; 
    int product_life;
    int status; 
-   int product_semaphore;
+   long reservable;
+   int first_lot;
+   int type;
+};
+
+/*
+ *
+ * This struct represents a single lot of a product offered by a port. The lots are 
+ * allocated in a pool in shared memory, where each port owns SO_PORTI-th of the pool and 
+ * keeps its free lots in a list. The lots of a product are kept in a list ordered 
+ * by product_life, so that the lots that expire first are the first to be shipped:
+ *    - the tons of the lot still in the port
+ *    - the life of the lot
+ *    - the index of the next lot in the list (of the product or of the free lots), -1 if none
+ *
+ */
+struct lot {
+   long ton;
+   int product_life;
+   int next;
+};
+
+/*
+ *
+ * This struct represents a lot on board of a ship: as struct lot, plus the port where
+ * it was loaded and when (in days), so that its lane is known when it's delivered
+ *
+ */
+struct cargo_lot {
+   long ton;
+   int product_life;
+   int next;
+   int origin;
+   double loaded_at;
+};
+
+/*
+ *
+ * This struct represents the traffic of a lane, from the port where the tons were loaded
+ * to the port where they were delivered: the tons, the number of lots delivered (voyages) 
+ * and the sum of their transit times (in days). The origin is -1 in an unused element of a table
+ *
+ */
+struct lane {
+   int origin;
+   int destination;
+   long tons;
+   long voyages;
+   double transit;
 };
 
 /*
@@ -63,21 +252,17 @@ struct product {
  * This struct contains the infos about a single port:
  *    - his pid
  *    - his coordinates
- *    - the id of his semaphores (representing the quays of the port)
  *    - the id of his message queue
- *    - the array of products that the port offers and the correspondent shared memory id
- *    - the array of products that the port demands and the correspondent shared memory id
+ *    - the number of products in his catalogue (see struct shared_header)
+ *    - the index of the first free lot of the port in the lots pool
  */
 struct port_info {
    pid_t port_pid;
    float coord_x;
    float coord_y;
-   int quays_id;
    int msg_queue_id;
-   int off_shm_id;
-   struct product *my_products_offer;
-   int dem_shm_id;
-   struct product *my_products_demand;
+   int products_count;
+   int free_lot;
 };
 
 /* 
@@ -94,7 +279,23 @@ struct ship_info {
  *
  * This struct contains the configuration variables of the simulation.
  * This struct is initialized by the master in his setup phase 
- * by reading from a file specified by the user
+ * by reading from a file specified by the user.
+ * SO_GEN_PERIOD and SO_GEN_FILL are optional: every SO_GEN_PERIOD days each port generates
+ * up to SO_GEN_FILL tons of offer and of demand, without ever exceeding its share of SO_FILL.
+ * If SO_GEN_PERIOD is 0 the offer and the demand are generated only at the beginning.
+ * SO_ACTIVE_MERCI is optional too: it is the number of products that each port offers or
+ * demands, drawn randomly among the SO_MERCI products. If it is 0 every port trades all of them.
+ * SO_ZYGOTE is optional as well: if it is not 0 the master starts a single port and a single ship,
+ * which set up what is common to their role and then fork all the other ports and ships (see spawn_processes).
+ * SO_EXECUTORS is optional: if it is not 0 the ships are hosted by SO_EXECUTORS processes (one for each
+ * online processor if it is negative, never more than SO_NAVI), each one running many ships as coroutines.
+ * SO_PORT_THREADS is optional: if it is not 0 all the ports are hosted by a single process, where
+ * SO_PORT_THREADS threads handle the messages of the ships.
+ * SO_TIMER_SLACK is optional: if it is not 0 it is the timer slack (in nanoseconds) of every process,
+ * that is how much later than requested the kernel may end their sleeps to group the wake-ups
+ * (1 for the most punctual sleeps). If it is 0 the default of the kernel (50 microseconds) is kept.
+ * SO_SEED is optional: it is the seed of every random number of the run (see struct random_state),
+ * so that the same seed builds the same world. If it is 0 the master draws one (see --seed).
  * 
  */
 struct config_variables {
@@ -108,9 +309,17 @@ struct config_variables {
    float SO_SPEED;
    int SO_CAPACITY; 
    int SO_BANCHINE;
-   int SO_FILL;
+   long SO_FILL;
    float SO_LOADSPEED;
    int SO_DAYS;
+   int SO_GEN_PERIOD;
+   int SO_GEN_FILL;
+   int SO_ACTIVE_MERCI;
+   int SO_ZYGOTE;
+   int SO_EXECUTORS;
+   int SO_PORT_THREADS;
+   long SO_TIMER_SLACK;
+   unsigned long SO_SEED;
 };
 
 /*
@@ -135,7 +344,9 @@ struct config_variables {
  * 
  * The sender field is valued with the pid of the ship that starts the conversation.
  * The prod_id field is valued with the id of the product that the ship wants to load/unload.
- * The tons field is valued with the tons of product that the ship intends to load/unload
+ * The tons field is valued with the tons of product that the ship intends to load/unload.
+ * The port field is valued with the index of the destination port: when a single process hosts
+ * all the ports (see SO_PORT_THREADS) they share the message queue
  * 
  */
 struct my_msgbuf {
@@ -143,7 +354,8 @@ struct my_msgbuf {
    int type;
    pid_t sender;
    int prod_id;
-   int tons;
+   long tons;
+   int port;
 };
 
 /*
@@ -170,12 +382,15 @@ struct my_ackbuf {
    int type; 
    pid_t sender;
    int prod_id;
-   int tons;
+   long tons;
+   int port;
 };
 
 /* 
  * 
  * This struct contains the stats of a single product:
+ *    - generated is the counter of the tons of the product that
+ *      have been generated since the beginning of the simulation
  *    - available_port is the counter of the tons of the product that 
  *      are available in the ports
  *    - on_ship is the counter of the tons of the product that 
@@ -193,11 +408,12 @@ struct my_ackbuf {
  *   
  */
 struct prod_stats {
-   int available_port;
-   int on_ship;
-   int delivered;
-   int expired_port;
-   int expired_ship;
+   long generated;
+   long available_port;
+   long on_ship;
+   long delivered;
+   long expired_port;
+   long expired_ship;
    pid_t top_offering_port;
    pid_t top_demanding_port;
 };
@@ -215,20 +431,318 @@ struct prod_stats {
  *   
  */
 struct port_stats {
-   int tons_available;
-   int tons_shipped;
-   int tons_delivered;
-   int tons_expired;
+   long tons_available;
+   long tons_shipped;
+   long tons_delivered;
+   long tons_expired;
    int total_quays;
    int occupied_quays;
 };
 
+/*
+ *
+ * This struct lists the IPC objects created by the master, so that they can be
+ * removed together at the end of the simulation or after a crash (see --cleanup):
+ *    - the pid of the master that created them, to tell if the run is still alive
+ *    - the number of objects and, for each one, its kind (IPC_OBJECT_SHM, IPC_OBJECT_SEM
+ *      or IPC_OBJECT_MSG) and its id
+ * The message queues of the ports are not listed, they are found in the infos of the ports
+ *
+ */
+struct ipc_registry {
+   pid_t master_pid;
+   int count;
+   int kinds[IPC_REGISTRY_SIZE];
+   int ids[IPC_REGISTRY_SIZE];
+};
+
+/*
+ *
+ * This struct contains the accounting of an IPC call: the number of calls, the ones 
+ * that failed (interrupted or that would block too), the total and the maximum latency (in ns)
+ * and the histogram of the latencies. The latency of a blocking call includes the time it waited
+ *
+ */
+struct ipc_call_stats {
+   unsigned long calls;
+   unsigned long failed;
+   unsigned long total_ns;
+   unsigned long max_ns;
+   unsigned long histogram[IPC_HISTOGRAM_BUCKETS];
+};
+
+/*
+ *
+ * This struct is the state of a stream of random numbers (xoshiro256**). The master, each port
+ * and each ship draw from their own stream, derived from SO_SEED, their role (IPC_ROLE_MASTER...)
+ * and their index (see random_seed): the numbers of an entity don't depend on the others,
+ * on the scheduling or on how the entities are hosted (processes, threads or executors)
+ *
+ */
+struct random_state {
+   uint64_t s[4];
+};
+
+/*
+ *
+ * This struct contains the delays (in microseconds) of a kind of sleep from its requested
+ * wake-up (see SKEW_VOYAGE): the number of sleeps, the ones whose delay made them end in a 
+ * later day than requested (a deadline missed because of the scheduling, not of the model),
+ * the maximum delay and the histogram of the delays
+ *
+ */
+struct sleep_skew {
+   unsigned long sleeps;
+   unsigned long missed;
+   unsigned long max;
+   unsigned long histogram[HDR_BUCKETS];
+};
+
+/*
+ *
+ * This struct is the header of the simulation, it is placed in shared memory
+ * by the master and its id is passed to every port and ship:
+ *    - the configuration variables of the simulation
+ *    - the instant (CLOCK_MONOTONIC) in which the simulation started, used
+ *      to compute the current simulated time with a fractional precision
+ *    - the id of the shared memory that contains the quays calendar: for each
+ *      port there are SO_BANCHINE elements, each one is the simulated time in 
+ *      which the correspondent quay will be free according to the bookings
+ *    - the id of the semaphores array (one semaphore for each port) used as
+ *      mutex to access the calendar and the admission queue of a port
+ *    - the id of the semaphores array (one semaphore for each port) representing
+ *      the free quays of the ports
+ *    - the id of the shared memory that contains the admission queues of the ports
+ *    - the id of the shared memory that contains the slots of the ships
+ *    - the ids of the semaphores arrays (one semaphore for each ship) used to wake up
+ *      a ship waiting in an admission queue, and the number of ships of each array:
+ *      the semaphore of a ship is found with ship_semaphore
+ *    - the counters used by the ports, by the ships and by the processes hosting the ships 
+ *      (see SO_EXECUTORS) to get their own index
+ *    - the id of the shared memory that contains the lots pool and the number of lots of each port
+ *    - the id of the shared memory that contains the catalogues of the ports and the number of
+ *      products reserved to each port: the catalogue of a port is the list of the products that 
+ *      the port offers or demands, ordered by product_id, and starts at index port * catalogue_stride.
+ *      Only the products actually traded are in the catalogue, so its size doesn't depend on SO_MERCI
+ *    - the id of the shared memory that contains, for each product, the list of the catalogue
+ *      elements of the product (offered or demanded), ordered by port: the first SO_MERCI+1 integers
+ *      are the offsets of the lists, followed by the lists. It is filled by the master once 
+ *      every port completed its setup
+ *    - the id of the shared memory that contains the infos of the ports
+ *    - the registry of the IPC objects of the simulation
+ *    - the id of the shared memory that contains the trace rings, -1 if the events are not traced
+ *    - the id of the shared memory that contains the times of the quays of each port
+ *    - the id of the shared memory that contains the usage of each ship
+ *    - the id of the shared memory that contains the pool of the lanes added by the ship processes,
+ *      its size, the lanes added and the tons of the lanes that didn't fit
+ *    - the accounting of the IPC calls of each role: every process adds its own when it ends
+ *    - the delays of the sleeps of each kind
+ *    - the counters of the updates of the stats that started and that ended: every group of 
+ *      updates that moves tons (or ships) from a counter to another is surrounded by 
+ *      stats_update_begin and stats_update_end, so that the master can take a consistent 
+ *      copy of the stats when no group is in progress, without blocking the writers
+ *
+ */
+struct shared_header {
+   struct config_variables config;
+   struct timespec sim_start;
+   int calendar_shm_id;
+   int quays_lock_id;
+   int quays_sem_id;
+   int queues_shm_id;
+   int ship_slots_shm_id;
+   int ships_sem_ids[SHIP_SEM_SETS];
+   int ships_per_sem_set;
+   int ports_count;
+   int ships_count;
+   int executors_count;
+   int lots_shm_id;
+   int lots_per_port;
+   int catalogue_shm_id;
+   int catalogue_stride;
+   int product_index_shm_id;
+   int ports_shm_id;
+   struct ipc_registry registry;
+   int trace_shm_id;
+   int quay_stats_shm_id;
+   int ship_usage_shm_id;
+   int lanes_shm_id;
+   int lanes_size;
+   int lanes_count;
+   long lanes_lost;
+   struct ipc_call_stats ipc_stats[IPC_ROLES][IPC_CALLS];
+   struct sleep_skew skew[SKEW_KINDS];
+   unsigned long stats_begin;
+   unsigned long stats_end;
+};
+
+/*
+ *
+ * This struct represents the admission queue of the quays of a single port and 
+ * the load of the port published for the routing of the ships.
+ * The ships waiting for a quay are linked through their slots (see struct ship_slot):
+ *    - head is the index of the first ship in the queue, -1 if the queue is empty
+ *    - waiting is the number of ships in the queue
+ *    - inbound is the number of ships currently sailing to the port
+ * The number of occupied quays is in struct port_stats
+ *
+ */
+struct quays_queue {
+   int head;
+   int waiting;
+   int inbound;
+};
+
+/*
+ *
+ * This struct contains the times (in microseconds) of the quays of a single port:
+ *    - the number of ships that docked
+ *    - the maximum time a ship waited for a quay and the histogram of the waits
+ *    - the maximum time a ship held a quay (loading and unloading) and the histogram of the holds
+ *
+ */
+struct quay_stats {
+   unsigned long docks;
+   unsigned long wait_max;
+   unsigned long hold_max;
+   unsigned long wait[HDR_BUCKETS];
+   unsigned long hold[HDR_BUCKETS];
+};
+
+/*
+ *
+ * This struct contains the infos about a single ship that are shared with the other processes:
+ *    - his pid
+ *    - the priority of the ship in an admission queue, that is the product_life of the 
+ *      most urgent lot involved in the planned exchange (lower is more urgent)
+ *    - the number of times the ship has been overtaken while waiting in the queue
+ *    - the index of the next ship in the queue, -1 if it's the last one
+ *
+ */
+struct ship_slot {
+   pid_t ship_pid;
+   int priority;
+   int bypassed;
+   int next;
+};
+
+/*
+ *
+ * This struct contains the trip chosen by a ship (see plan_trip):
+ *    - the index in the catalogue of the destination port of the product to exchange
+ *    - the exchange: 0 to load the product, 1 to unload it
+ *    - the product with the most urgent lot on board when unloading, -1 otherwise
+ *    - the tons reserved
+ *    - the distance to the port and the whole seconds of the navigation
+ *
+ */
+struct trip_plan {
+   int element;
+   int action;
+   int most_urgent;
+   long tons;
+   float distance;
+   time_t seconds;
+};
+
+/*
+ *
+ * This struct contains how a single ship spent the simulation, written only by the ship:
+ *    - the time (in days) spent sailing with some cargo and empty, waiting for a quay 
+ *      and loading or unloading
+ *    - the tons carried multiplied by the distance sailed
+ *    - the tons delivered and the ones that expired on board
+ *    - the exchanges that failed: nothing left to reserve or the request rejected by the port
+ *
+ */
+struct ship_usage {
+   double sailing_loaded;
+   double sailing_empty;
+   double waiting;
+   double exchanging;
+   double ton_distance;
+   long delivered;
+   long expired;
+   long failed_reservations;
+};
+
+/*
+ *
+ * This struct contains the resources used by a port or ship process, taken by the master 
+ * when it reaps the process (see wait4):
+ *    - its pid, its role (IPC_ROLE_PORT or IPC_ROLE_SHIP) and the index of the first port or 
+ *      ship it hosted (with SO_PORT_THREADS or in executor mode a process hosts many of them)
+ *    - the user and system CPU time, in seconds
+ *    - the voluntary and involuntary context switches
+ *    - the maximum resident set size, in kilobytes, and the minor page faults
+ *
+ */
+struct process_usage {
+   pid_t pid;
+   int role;
+   int index;
+   double user;
+   double sys;
+   long voluntary;
+   long involuntary;
+   long max_rss;
+   long minor_faults;
+};
+
+/*
+ *
+ * This struct represents a traced event:
+ *    - the simulated time of the event (days from the simulation start, with fractional precision)
+ *    - the type of the event (TRACE_SAIL...)
+ *    - the index of the port involved, the id of the product and the tons (-1 if not relevant)
+ *
+ */
+struct trace_event {
+   double time;
+   int type;
+   int port;
+   int product;
+   long tons;
+};
+
+/*
+ *
+ * This struct is the trace ring of a port or of a ship, in shared memory (see --trace): the ring
+ * has a single writer (the port or the ship) and a single reader (the master), so no lock is needed.
+ *    - the number of events written and the number of events read: the writer publishes an event
+ *      incrementing "head", the reader frees the events incrementing "tail"
+ *    - the number of events lost because the ring was full
+ *    - 1 while the writer is writing an event: a signal handler of the writer that traces an 
+ *      event in the meantime loses it, instead of overwriting the event being written
+ *    - the events
+ * The rings of the ports come first, followed by the ones of the ships
+ *
+ */
+struct trace_ring {
+   unsigned long head;
+   unsigned long tail;
+   unsigned long dropped;
+   int busy;
+   struct trace_event events[TRACE_RING_SIZE];
+};
+
+/*
+ *
+ * This struct is a record of the trace file written by the master: the index of the ring 
+ * (ports first, then ships) and the event. The file starts with the magic "SOTR", the 
+ * version of the trace (uint32), SO_PORTI and SO_NAVI (int32)
+ *
+ */
+struct trace_file_record {
+   int ring;
+   struct trace_event event;
+};
+
 /* Union */
 
 /*
  *
- * This struct is used to initialize the semaphores of the products for 
- * both the demand and the offer.
+ * This struct is used to initialize the semaphores of the quays and the mutexes.
  * 
  */
 union semun {
@@ -245,3 +759,28 @@ struct config_variables setup_config_variables(char* configuration_file);
 void handle_signal(int);
 
 
+
+int find_product(struct product *, int, int, int);
+long take_reservable(long *, long);
+void give_reservable(long *, long);
+void spawn_processes(int);
+void stats_update_begin(struct shared_header *);
+void stats_update_end(struct shared_header *);
+int ship_semaphore(struct shared_header *, int, struct sembuf *);
+void trace_emit(struct shared_header *, struct trace_ring *, int, int, int, long);
+int ipc_semop(int, struct sembuf *, size_t);
+int ipc_semctl(int, int, int, union semun);
+int ipc_msgsnd(int, const void *, size_t, int);
+ssize_t ipc_msgrcv(int, void *, size_t, long, int);
+void *ipc_shmat(int, const void *, int);
+int ipc_shmdt(const void *);
+void ipc_stats_publish(struct shared_header *, int);
+void hdr_record(unsigned long *, unsigned long *, unsigned long);
+void skew_record(struct shared_header *, int, double, double);
+uint64_t random_mix(uint64_t);
+void random_seed(struct random_state *, unsigned long, int, int);
+uint64_t random_next(struct random_state *);
+long random_below(struct random_state *, long);
+double random_unit(struct random_state *);
+unsigned long hdr_bucket_value(int);
+unsigned long hdr_percentile(unsigned long *, unsigned long, double);